@@ -0,0 +1,79 @@
+#include "StdAfx.h"
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+using namespace std;
+
+#ifdef COUNT_ALLOCATIONS
+
+static atomic<long long> g_allocationCount(0);
+
+void* operator new(size_t size)
+{
+	g_allocationCount++;
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const nothrow_t&) throw()
+{
+	g_allocationCount++;
+	return malloc(size > 0 ? size : 1);
+}
+
+void* operator new[](size_t size, const nothrow_t& tag) throw()
+{
+	return operator new(size, tag);
+}
+
+void operator delete(void* p) throw()
+{
+	if (p == NULL)
+		return;
+	g_allocationCount++;
+	free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, size_t) throw()
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p, size_t) throw()
+{
+	operator delete(p);
+}
+
+void operator delete(void* p, const nothrow_t&) throw()
+{
+	operator delete(p);
+}
+
+void operator delete[](void* p, const nothrow_t&) throw()
+{
+	operator delete(p);
+}
+
+long long GetAllocationCount() { return g_allocationCount.load(); }
+bool IsAllocationCountingEnabled() { return true; }
+
+#else
+
+long long GetAllocationCount() { return 0; }
+bool IsAllocationCountingEnabled() { return false; }
+
+#endif
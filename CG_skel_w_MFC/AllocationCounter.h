@@ -0,0 +1,11 @@
+#pragma once
+
+// Process wide count of heap calls made through operator new and delete,
+// by every thread, for checking that steady frames leave the heap alone.
+// Counting replaces the global operators, so it is only built into builds
+// defining COUNT_ALLOCATIONS (the Debug configuration); elsewhere the count
+// stays 0. Files that #define new DEBUG_NEW (CG_skel_w_MFC.cpp) call MFC's
+// debug operator new instead, which isn't counted; the frame loop doesn't
+// allocate there.
+long long GetAllocationCount();
+bool IsAllocationCountingEnabled();
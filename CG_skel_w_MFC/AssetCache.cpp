@@ -0,0 +1,186 @@
+#include "StdAfx.h"
+#include "AssetCache.h"
+#include <iostream>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#include <limits.h>
+#include <stdlib.h>
+#endif
+
+using namespace std;
+
+// 256MB of vertex data before anything is evicted
+#define DEFAULT_BUDGET (256u << 20)
+
+AssetCache::AssetCache() : m_budget(DEFAULT_BUDGET), m_bytes(0), m_hits(0), m_misses(0), m_evictions(0)
+{
+}
+
+AssetCache& AssetCache::instance()
+{
+	static AssetCache cache;
+	return cache;
+}
+
+MeshGeometryPtr AssetCache::loadMesh(const string& fileName)
+{
+	string path;
+	FileIdentity identity;
+	if (!canonicalPath(fileName, path) || !fileIdentity(path, identity))
+	{
+		cout << "Could not open \"" << fileName << "\"" << endl;
+		return MeshGeometryPtr();
+	}
+
+	{
+		lock_guard<mutex> lock(m_mutex);
+		map<string, Entry>::iterator it = m_entries.find(path);
+		if (it != m_entries.end())
+		{
+			if (it->second.identity == identity)
+			{
+				m_hits++;
+				m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+				return it->second.geometry;
+			}
+			// the file changed on disk, drop the stale copy
+			erase(it);
+		}
+		m_misses++;
+	}
+
+	// parse outside the lock so other lookups aren't held up by a big file
+	shared_ptr<MeshGeometry> geometry(new MeshGeometry());
+	geometry->loadFile(path);
+
+	lock_guard<mutex> lock(m_mutex);
+	map<string, Entry>::iterator it = m_entries.find(path);
+	if (it != m_entries.end() && it->second.identity == identity)
+		return it->second.geometry;	// another thread loaded it meanwhile
+	if (it != m_entries.end())
+		erase(it);
+
+	m_lru.push_front(path);
+	Entry& entry = m_entries[path];
+	entry.identity = identity;
+	entry.geometry = geometry;
+	entry.bytes = geometry->memorySize();
+	entry.lru = m_lru.begin();
+	m_bytes += entry.bytes;
+	MeshGeometryPtr result = entry.geometry;
+	evictToBudget();
+	return result;
+}
+
+void AssetCache::setMemoryBudget(size_t bytes)
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_budget = bytes;
+	evictToBudget();
+}
+
+void AssetCache::clear()
+{
+	lock_guard<mutex> lock(m_mutex);
+	m_entries.clear();
+	m_lru.clear();
+	m_bytes = 0;
+}
+
+size_t AssetCache::getMemoryBudget() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_budget;
+}
+
+size_t AssetCache::getMemoryUsage() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_bytes;
+}
+
+unsigned AssetCache::getHits() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_hits;
+}
+
+unsigned AssetCache::getMisses() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_misses;
+}
+
+unsigned AssetCache::getEvictions() const
+{
+	lock_guard<mutex> lock(m_mutex);
+	return m_evictions;
+}
+
+void AssetCache::erase(map<string, Entry>::iterator it)
+{
+	m_bytes -= it->second.bytes;
+	m_lru.erase(it->second.lru);
+	m_entries.erase(it);
+}
+
+void AssetCache::evictToBudget()
+{
+	// the most recent entry always stays, even if it alone exceeds the budget
+	while (m_bytes > m_budget && m_lru.size() > 1)
+	{
+		erase(m_entries.find(m_lru.back()));
+		m_evictions++;
+	}
+}
+
+bool AssetCache::canonicalPath(const string& fileName, string& canonical)
+{
+#ifdef _WIN32
+	char full[MAX_PATH];
+	DWORD len = GetFullPathNameA(fileName.c_str(), MAX_PATH, full, NULL);
+	if (len == 0 || len >= MAX_PATH)
+		return false;
+	// NTFS paths are case insensitive
+	canonical = full;
+	transform(canonical.begin(), canonical.end(), canonical.begin(), ::tolower);
+	replace(canonical.begin(), canonical.end(), '/', '\\');
+#else
+	char full[PATH_MAX];
+	if (realpath(fileName.c_str(), full) == NULL)
+		return false;
+	canonical = full;
+#endif
+	return true;
+}
+
+bool AssetCache::fileIdentity(const string& fileName, FileIdentity& identity)
+{
+#ifdef _WIN32
+	HANDLE file = CreateFileA(fileName.c_str(), 0, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+		NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE)
+		return false;
+	BY_HANDLE_FILE_INFORMATION info;
+	BOOL ok = GetFileInformationByHandle(file, &info);
+	CloseHandle(file);
+	if (!ok)
+		return false;
+	identity.volume = info.dwVolumeSerialNumber;
+	identity.index = ((unsigned long long)info.nFileIndexHigh << 32) | info.nFileIndexLow;
+	identity.size = ((unsigned long long)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+	identity.mtime = ((long long)info.ftLastWriteTime.dwHighDateTime << 32) | info.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(fileName.c_str(), &st) != 0)
+		return false;
+	identity.volume = st.st_dev;
+	identity.index = st.st_ino;
+	identity.size = st.st_size;
+	identity.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+#endif
+	return true;
+}
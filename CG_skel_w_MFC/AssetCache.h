@@ -0,0 +1,71 @@
+#pragma once
+#include "MeshGeometry.h"
+#include <string>
+#include <list>
+#include <map>
+#include <mutex>
+
+using namespace std;
+
+// Identity of a file on disk. Two paths that resolve to the same file compare
+// equal, and any rewrite of the file changes size or mtime.
+struct FileIdentity
+{
+	unsigned long long volume;	// device / volume serial
+	unsigned long long index;	// inode / NTFS file index
+	unsigned long long size;
+	long long mtime;
+
+	bool operator==(const FileIdentity& o) const
+	{
+		return volume == o.volume && index == o.index && size == o.size && mtime == o.mtime;
+	}
+	bool operator!=(const FileIdentity& o) const { return !(*this == o); }
+};
+
+// Process-wide cache of loaded meshes, keyed by canonical path and checked
+// against the file's identity on every lookup. Returned geometry is shared
+// and immutable. Least recently used entries are evicted once the cache
+// holds more than its memory budget; meshes still referenced by models stay
+// alive through their own shared pointers.
+class AssetCache
+{
+	struct Entry
+	{
+		FileIdentity identity;
+		MeshGeometryPtr geometry;
+		size_t bytes;
+		list<string>::iterator lru;
+	};
+
+	map<string, Entry> m_entries;
+	list<string> m_lru;	// most recently used first
+	size_t m_budget;
+	size_t m_bytes;
+	unsigned m_hits, m_misses, m_evictions;
+	mutable mutex m_mutex;
+
+	AssetCache();
+	void erase(map<string, Entry>::iterator it);
+	void evictToBudget();
+
+public:
+	static AssetCache& instance();
+
+	// Returns the cached mesh for fileName, loading it on a miss or when the
+	// file changed since it was cached. Empty pointer if the file can't be read.
+	MeshGeometryPtr loadMesh(const string& fileName);
+
+	void setMemoryBudget(size_t bytes);
+	size_t getMemoryBudget() const;
+	size_t getMemoryUsage() const;
+	void clear();
+
+	// counters are read under the lock, any thread may be loading meanwhile
+	unsigned getHits() const;
+	unsigned getMisses() const;
+	unsigned getEvictions() const;
+
+	static bool canonicalPath(const string& fileName, string& canonical);
+	static bool fileIdentity(const string& fileName, FileIdentity& identity);
+};
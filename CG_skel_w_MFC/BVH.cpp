@@ -0,0 +1,205 @@
+#include "StdAfx.h"
+#include "BVH.h"
+#include <algorithm>
+
+using namespace std;
+
+BVH::BVH() : m_needsRebuild(false), m_area(0), m_builtArea(0), m_rebuilds(0), rebuildThreshold(1.5f)
+{
+}
+
+void BVH::insert(int item, const AABB& bounds)
+{
+	if (item >= (int)m_itemBounds.size())
+	{
+		m_itemBounds.resize(item + 1);
+		m_itemPresent.resize(item + 1, 0);
+		m_itemLeaf.resize(item + 1, -1);
+	}
+	m_itemBounds[item] = bounds;
+	m_itemPresent[item] = 1;
+	m_needsRebuild = true;
+}
+
+void BVH::remove(int item)
+{
+	if (item < (int)m_itemPresent.size() && m_itemPresent[item])
+	{
+		m_itemPresent[item] = 0;
+		m_needsRebuild = true;
+	}
+}
+
+void BVH::setBounds(int item, const AABB& bounds)
+{
+	m_itemBounds[item] = bounds;
+	if (m_needsRebuild)
+		return;
+	int leaf = m_itemLeaf[item];
+	if (!m_leafQueued[leaf])
+	{
+		m_leafQueued[leaf] = 1;
+		m_refitLeaves.push_back(leaf);
+	}
+}
+
+void BVH::update()
+{
+	if (!m_needsRebuild)
+	{
+		// refit: walk up from each moved leaf until the bounds stop changing
+		for (size_t i = 0; i < m_refitLeaves.size(); i++)
+		{
+			int node = m_refitLeaves[i];
+			m_leafQueued[node] = 0;
+			AABB bounds = leafBounds(m_nodes[node]);
+			while (node != -1 && !(bounds == m_nodes[node].bounds))
+			{
+				setNodeBounds(node, bounds);
+				node = m_nodes[node].parent;
+				if (node != -1)
+				{
+					bounds = m_nodes[m_nodes[node].left].bounds;
+					bounds.expand(m_nodes[m_nodes[node].right].bounds);
+				}
+			}
+		}
+		m_refitLeaves.clear();
+		if (m_area <= m_builtArea * rebuildThreshold)
+			return;
+	}
+
+	m_nodes.clear();
+	m_order.clear();
+	for (size_t i = 0; i < m_itemPresent.size(); i++)
+	{
+		m_itemLeaf[i] = -1;
+		if (m_itemPresent[i])
+			m_order.push_back((int)i);
+	}
+	m_area = 0;
+	if (!m_order.empty())
+		buildNode(0, (int)m_order.size(), -1);
+	m_builtArea = m_area;
+	m_leafQueued.assign(m_nodes.size(), 0);
+	m_refitLeaves.clear();
+	m_needsRebuild = false;
+	m_rebuilds++;
+}
+
+// Orders items by the center of their bounds along one axis.
+struct CenterLess
+{
+	const vector<AABB>* bounds;
+	int axis;
+
+	bool operator()(int a, int b) const
+	{
+		const AABB& ba = (*bounds)[a];
+		const AABB& bb = (*bounds)[b];
+		return ba.lo[axis] + ba.hi[axis] < bb.lo[axis] + bb.hi[axis];
+	}
+};
+
+int BVH::buildNode(int first, int count, int parent)
+{
+	int index = (int)m_nodes.size();
+	m_nodes.push_back(Node());
+	Node node;
+	node.parent = parent;
+	node.left = node.right = -1;
+	node.first = first;
+	node.count = count;
+
+	if (count <= LEAF_SIZE)
+	{
+		for (int i = first; i < first + count; i++)
+			m_itemLeaf[m_order[i]] = index;
+		node.bounds = leafBounds(node);
+		m_nodes[index] = node;
+		m_area += node.bounds.surfaceArea();
+		return index;
+	}
+
+	// median split along the longest axis of the item centers
+	AABB centers;
+	for (int i = first; i < first + count; i++)
+		centers.expand(m_itemBounds[m_order[i]].center());
+	vec3 size = centers.hi - centers.lo;
+	CenterLess less;
+	less.bounds = &m_itemBounds;
+	less.axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+	int half = count / 2;
+	nth_element(m_order.begin() + first, m_order.begin() + first + half, m_order.begin() + first + count, less);
+
+	node.count = 0;
+	m_nodes[index] = node;
+	int left = buildNode(first, half, index);
+	int right = buildNode(first + half, count - half, index);
+	m_nodes[index].left = left;
+	m_nodes[index].right = right;
+	AABB bounds = m_nodes[left].bounds;
+	bounds.expand(m_nodes[right].bounds);
+	m_nodes[index].bounds = bounds;
+	m_area += bounds.surfaceArea();
+	return index;
+}
+
+void BVH::setNodeBounds(int node, const AABB& bounds)
+{
+	m_area += bounds.surfaceArea() - m_nodes[node].bounds.surfaceArea();
+	m_nodes[node].bounds = bounds;
+}
+
+AABB BVH::leafBounds(const Node& leaf) const
+{
+	AABB bounds;
+	for (int i = leaf.first; i < leaf.first + leaf.count; i++)
+		bounds.expand(m_itemBounds[m_order[i]]);
+	return bounds;
+}
+
+void BVH::cull(const Frustum& frustum, vector<int>& visible)
+{
+	cull(frustum, visible, m_stack);
+}
+
+void BVH::cull(const Frustum& frustum, vector<int>& visible, vector<int>& stack) const
+{
+	if (m_nodes.empty())
+		return;
+
+	// nodes pushed with a negative sign are known to be fully inside
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty())
+	{
+		int entry = stack.back();
+		stack.pop_back();
+		bool inside = entry < 0;
+		const Node& node = m_nodes[inside ? ~entry : entry];
+
+		if (!inside)
+		{
+			int result = frustum.classify(node.bounds);
+			if (result == Frustum::OUTSIDE)
+				continue;
+			inside = result == Frustum::INSIDE;
+		}
+
+		if (node.left == -1)
+		{
+			for (int i = node.first; i < node.first + node.count; i++)
+			{
+				int item = m_order[i];
+				if (inside || frustum.classify(m_itemBounds[item]) != Frustum::OUTSIDE)
+					visible.push_back(item);
+			}
+		}
+		else
+		{
+			stack.push_back(inside ? ~node.left : node.left);
+			stack.push_back(inside ? ~node.right : node.right);
+		}
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <vector>
+#include "Bounds.h"
+
+using namespace std;
+
+// Bounding volume hierarchy over items identified by small integer ids
+// (the scene uses model indices). Moving an item only refits the path from
+// its leaf to the root; the tree is rebuilt from scratch when items are added
+// or removed, or when refitting has made it much looser than a fresh build.
+class BVH
+{
+	struct Node
+	{
+		AABB bounds;
+		int left, right;	// children, -1 for leaves
+		int parent;
+		int first, count;	// leaves: range in m_order
+	};
+
+	vector<Node> m_nodes;
+	vector<int> m_order;		// item ids, grouped by leaf
+	vector<AABB> m_itemBounds;	// indexed by item id
+	vector<char> m_itemPresent;
+	vector<int> m_itemLeaf;
+
+	vector<int> m_refitLeaves;
+	vector<char> m_leafQueued;
+	vector<int> m_stack;
+	bool m_needsRebuild;
+	float m_area;		// sum of all node surface areas
+	float m_builtArea;	// m_area right after the last build
+	int m_rebuilds;
+
+	int buildNode(int first, int count, int parent);
+	void setNodeBounds(int node, const AABB& bounds);
+	AABB leafBounds(const Node& leaf) const;
+
+public:
+	// leaves hold up to this many items
+	enum { LEAF_SIZE = 4 };
+
+	BVH();
+
+	void insert(int item, const AABB& bounds);
+	void remove(int item);
+	void setBounds(int item, const AABB& bounds);
+
+	// Applies pending changes: a rebuild if the item set changed or the tree
+	// degraded past the threshold, otherwise a refit of the moved leaves.
+	void update();
+
+	// Appends every item whose bounds aren't entirely outside the frustum.
+	void cull(const Frustum& frustum, vector<int>& visible);
+	// Same, with caller owned scratch, so several threads may cull at once.
+	void cull(const Frustum& frustum, vector<int>& visible, vector<int>& stack) const;
+
+	// Rebuild when the total node area grows past this factor of a fresh tree.
+	float rebuildThreshold;
+
+	int getRebuildCount() const { return m_rebuilds; }
+	int getNodeCount() const { return (int)m_nodes.size(); }
+};
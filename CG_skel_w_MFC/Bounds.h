@@ -0,0 +1,113 @@
+#pragma once
+#include "vec.h"
+#include "mat.h"
+#include <algorithm>
+#include <cfloat>
+
+// Axis aligned bounding box. A default constructed box is empty.
+struct AABB
+{
+	vec3 lo, hi;
+
+	AABB() : lo(FLT_MAX), hi(-FLT_MAX) {}
+	AABB(const vec3& l, const vec3& h) : lo(l), hi(h) {}
+
+	bool isEmpty() const { return lo.x > hi.x; }
+	vec3 center() const { return (lo + hi) * 0.5f; }
+	vec3 extent() const { return (hi - lo) * 0.5f; }
+
+	void expand(const vec3& p)
+	{
+		lo = vec3((std::min)(lo.x, p.x), (std::min)(lo.y, p.y), (std::min)(lo.z, p.z));
+		hi = vec3((std::max)(hi.x, p.x), (std::max)(hi.y, p.y), (std::max)(hi.z, p.z));
+	}
+
+	void expand(const AABB& b)
+	{
+		if (b.isEmpty())
+			return;
+		expand(b.lo);
+		expand(b.hi);
+	}
+
+	float surfaceArea() const
+	{
+		if (isEmpty())
+			return 0;
+		vec3 d = hi - lo;
+		return 2 * (d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+
+	bool operator==(const AABB& b) const
+	{
+		return lo.x == b.lo.x && lo.y == b.lo.y && lo.z == b.lo.z &&
+			hi.x == b.hi.x && hi.y == b.hi.y && hi.z == b.hi.z;
+	}
+};
+
+// Bounds of box after transforming it by m (Arvo's method).
+inline AABB TransformBounds(const AABB& box, const mat4& m)
+{
+	if (box.isEmpty())
+		return box;
+	vec3 c = box.center(), e = box.extent();
+	vec3 nc, ne;
+	for (int i = 0; i < 3; i++)
+	{
+		const vec4& r = m[i];
+		nc[i] = r.x*c.x + r.y*c.y + r.z*c.z + r.w;
+		ne[i] = fabs(r.x)*e.x + fabs(r.y)*e.y + fabs(r.z)*e.z;
+	}
+	return AABB(nc - ne, nc + ne);
+}
+
+// Six planes (left, right, bottom, top, near, far) of a view frustum, each
+// with its normal pointing inwards: a point p is inside when
+// dot(plane.xyz, p) + plane.w >= 0 for all of them.
+struct Frustum
+{
+	enum { OUTSIDE, INTERSECTS, INSIDE };
+
+	vec4 planes[6];
+
+	Frustum() {}
+
+	// Gribb/Hartmann extraction from a combined projection * view matrix.
+	explicit Frustum(const mat4& viewProjection)
+	{
+		const vec4& r0 = viewProjection[0];
+		const vec4& r1 = viewProjection[1];
+		const vec4& r2 = viewProjection[2];
+		const vec4& r3 = viewProjection[3];
+		planes[0] = r3 + r0;
+		planes[1] = r3 - r0;
+		planes[2] = r3 + r1;
+		planes[3] = r3 - r1;
+		planes[4] = r3 + r2;
+		planes[5] = r3 - r2;
+		for (int i = 0; i < 6; i++)
+		{
+			vec4& p = planes[i];
+			float len = sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+			if (len > 0)
+				p /= len;
+		}
+	}
+
+	int classify(const AABB& box) const
+	{
+		int result = INSIDE;
+		for (int i = 0; i < 6; i++)
+		{
+			const vec4& p = planes[i];
+			// corner furthest along the plane normal, and the one opposite to it
+			vec3 pv(p.x >= 0 ? box.hi.x : box.lo.x, p.y >= 0 ? box.hi.y : box.lo.y, p.z >= 0 ? box.hi.z : box.lo.z);
+			vec3 nv(p.x >= 0 ? box.lo.x : box.hi.x, p.y >= 0 ? box.lo.y : box.hi.y, p.z >= 0 ? box.lo.z : box.hi.z);
+			if (p.x*pv.x + p.y*pv.y + p.z*pv.z + p.w < 0)
+				return OUTSIDE;
+			if (p.x*nv.x + p.y*nv.y + p.z*nv.z + p.w < 0)
+				result = INTERSECTS;
+		}
+		return result;
+	}
+};
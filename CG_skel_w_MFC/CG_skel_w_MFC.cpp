@@ -20,7 +20,10 @@
 #include "InitShader.h"
 #include "Scene.h"
 #include "Renderer.h"
+#include "RenderThread.h"
+#include "AllocationCounter.h"
 #include <string>
+#include <cstring>
 
 #define BUFFER_OFFSET( offset )   ((GLvoid*) (offset))
 
@@ -28,23 +31,106 @@
 #define MAIN_DEMO 1
 #define MAIN_ABOUT 2
 
+// how often to check for frames finished by the render thread, only while
+// one is being drawn
+#define FRAME_POLL_MS 5
+
+// while the camera is dragged, frames are drawn at this fraction of the
+// window's width and height; a full resolution frame follows once the
+// mouse rested for INPUT_IDLE_MS
+#define DRAG_RESOLUTION 0.5f
+#define INPUT_IDLE_MS 150
+
+// frame time held by lowering the resolution further when needed
+#define FRAME_BUDGET_MS 16.6f
+
+// frames --check-allocations draws before it starts counting
+#define ALLOCATION_WARMUP_FRAMES 10
+
 Scene *scene;
 Renderer *renderer;
+RenderThread *renderThread;
 
 int last_x,last_y;
 bool lb_down,rb_down,mb_down;
+bool watchingFrames;
+int lastInputTime;
+bool watchingInput;
 
 //----------------------------------------------------------------------------
 // Callbacks
 
+void checkFrame( int value )
+{
+	// stop watching once the render thread has nothing left to hand back
+	bool busy = renderThread->isBusy();
+	if (renderer->HasNewFrame())
+		glutPostRedisplay();
+	if (busy)
+		glutTimerFunc(FRAME_POLL_MS, checkFrame, 0);
+	else
+		watchingFrames = false;
+}
+
+void watchFrames()
+{
+	if (watchingFrames)
+		return;
+	watchingFrames = true;
+	glutTimerFunc(FRAME_POLL_MS, checkFrame, 0);
+}
+
+void checkInputIdle( int value )
+{
+	int idle = glutGet(GLUT_ELAPSED_TIME) - lastInputTime;
+	if (idle < INPUT_IDLE_MS)
+	{
+		glutTimerFunc(INPUT_IDLE_MS - idle, checkInputIdle, 0);
+		return;
+	}
+	watchingInput = false;
+	renderThread->setResolutionScale(1.0f);
+	renderThread->publish(true);
+	watchFrames();
+}
+
+// Draws at reduced resolution until input stops for a while.
+void inputActive()
+{
+	lastInputTime = glutGet(GLUT_ELAPSED_TIME);
+	renderThread->setResolutionScale(DRAG_RESOLUTION);
+	if (watchingInput)
+		return;
+	watchingInput = true;
+	glutTimerFunc(INPUT_IDLE_MS, checkInputIdle, 0);
+}
+
+// Called by the scene on its first change since the last snapshot.
+void invalidate()
+{
+	glutPostRedisplay();
+}
+
 void display( void )
 {
 //Call the scene and ask it to draw itself
+	// the scene is drawn on the render thread from a snapshot taken only
+	// when it changed; until then the latest frame is shown again
+	if (scene->isDirty())
+	{
+		renderThread->publish();
+		watchFrames();
+	}
+	renderer->ShowLatestFrame();
 }
 
 void reshape( int width, int height )
 {
 //update the renderer's buffers
+	glViewport(0, 0, width, height);
+	renderThread->setFrameSize(width, height);
+	renderThread->publish();
+	watchFrames();
 }
 
 void keyboard( unsigned char key, int x, int y )
@@ -74,6 +160,13 @@ void mouse(int button, int state, int x, int y)
 			break;
 	}
 
+	// a drag starts where the button went down, not where the last one ended
+	if (state == GLUT_DOWN)
+	{
+		last_x = x;
+		last_y = y;
+	}
+
 	// add your code
 }
 
@@ -85,6 +178,14 @@ void motion(int x, int y)
 	// update last x,y
 	last_x=x;
 	last_y=y;
+
+	// left drag orbits the active camera around the world's y axis
+	Camera* camera = scene->getActiveCamera();
+	if (lb_down && camera != NULL && dx != 0)
+	{
+		inputActive();
+		camera->setTransformation(camera->getTransformation() * RotateY(0.5f * dx));
+	}
 }
 
 void fileMenu(int id)
@@ -107,7 +208,8 @@ void mainMenu(int id)
 	switch (id)
 	{
 	case MAIN_DEMO:
-		scene->drawDemo();
+		renderThread->showDemo();
+		watchFrames();
 		break;
 	case MAIN_ABOUT:
 		AfxMessageBox(_T("Computer Graphics"));
@@ -130,8 +232,60 @@ void initMenu()
 
 
 
+// Headless check that steady frames leave the heap alone: draws the model
+// lit and shadowed, as the render thread does but without a window, and
+// fails if any frame after the warm-up called operator new or delete.
+//	CG_skel_w_MFC.exe --check-allocations model.obj [frames]
+// Needs a build defining COUNT_ALLOCATIONS.
+int checkFrameAllocations(const char* fileName, int frames)
+{
+	if (!IsAllocationCountingEnabled())
+	{
+		fprintf(stderr, "--check-allocations needs a build defining COUNT_ALLOCATIONS\n");
+		return 1;
+	}
+	Renderer frameRenderer(512, 512);
+	frameRenderer.SetShading(Renderer::SHADING_PHONG);
+	Scene checkScene(&frameRenderer);
+	Camera* camera = new Camera();
+	camera->LookAt(vec4(0,0,3,1), vec4(0,0,0,1), vec4(0,1,0,0));
+	camera->Perspective(45, 1, 0.1f, 100);
+	checkScene.addCamera(camera);
+	Light* key = new Light();
+	key->setDirectional(vec3(-0.5f, -1, -0.5f));
+	key->setShadows(1024);
+	checkScene.addLight(key);
+	Light* fill = new Light();
+	fill->setPoint(vec3(2, 1, 2), 8);
+	checkScene.addLight(fill);
+	checkScene.loadOBJModel(fileName);
+
+	SceneSnapshot snapshot;
+	SceneRenderer sceneRenderer;
+	int failed = 0;
+	for (int i = 0; i < ALLOCATION_WARMUP_FRAMES + frames; i++)
+	{
+		checkScene.snapshot(snapshot, frameRenderer.GetWidth(), frameRenderer.GetHeight());
+		frameRenderer.ClearColorBuffer();
+		frameRenderer.ClearDepthBuffer();
+		sceneRenderer.render(snapshot, frameRenderer);
+		frameRenderer.PublishFrame();
+		long long calls = frameRenderer.GetFrameAllocations();
+		if (i >= ALLOCATION_WARMUP_FRAMES && calls != 0)
+		{
+			fprintf(stderr, "frame %d: %lld heap calls\n", i - ALLOCATION_WARMUP_FRAMES, calls);
+			failed++;
+		}
+	}
+	printf("%d of %d steady frames made heap calls\n", failed, frames);
+	return failed == 0 ? 0 : 1;
+}
+
 int my_main( int argc, char **argv )
 {
+	if (argc >= 3 && strcmp(argv[1], "--check-allocations") == 0)
+		return checkFrameAllocations(argv[2], argc > 3 ? atoi(argv[3]) : 100);
+
 	//----------------------------------------------------------------------------
 	// Initialize window
 	glutInit( &argc, argv );
@@ -156,6 +310,24 @@ int my_main( int argc, char **argv )
 	renderer = new Renderer(512,512);
 	// TODO send also obj file
 	scene = new Scene(renderer);
+	Camera* camera = new Camera();
+	camera->LookAt(vec4(0,0,3,1), vec4(0,0,0,1), vec4(0,1,0,0));
+	camera->Perspective(45, 1, 0.1f, 100);
+	scene->addCamera(camera);
+	// a shadow casting key light from above and a warm point light at the
+	// front right
+	renderer->SetShading(Renderer::SHADING_PHONG);
+	Light* key = new Light();
+	key->setDirectional(vec3(-0.5f, -1, -0.5f));
+	key->setShadows(1024);
+	scene->addLight(key);
+	Light* fill = new Light();
+	fill->setPoint(vec3(2, 1, 2), 8);
+	fill->setColor(vec3(1, 0.9f, 0.7f), 0.6f);
+	scene->addLight(fill);
+	renderThread = new RenderThread(scene, renderer, 512, 512);
+	renderThread->setFrameBudget(FRAME_BUDGET_MS);
+	scene->setRedisplayCallback(invalidate);
 	//----------------------------------------------------------------------------
 	// Initialize Callbacks
 
@@ -168,6 +340,7 @@ int my_main( int argc, char **argv )
 	
 
 	glutMainLoop();
+	delete renderThread;
 	delete scene;
 	delete renderer;
 	return 0;
@@ -190,7 +363,7 @@ int main( int argc, char **argv )
 	}
 	else
 	{
-		my_main(argc, argv );
+		nRetCode = my_main(argc, argv );
 	}
 	
 	return nRetCode;
@@ -0,0 +1,52 @@
+#include "StdAfx.h"
+#include "DynamicResolution.h"
+#include <cmath>
+
+using namespace std;
+
+const float DynamicResolution::MIN_SCALE = 0.25f;
+const float DynamicResolution::STEP = 1.0f / 16;
+const float DynamicResolution::RAISE_BELOW = 0.7f;
+
+// weight of the newest frame in the running average
+#define AVERAGE_WEIGHT 0.3f
+// frame time aimed at when changing the scale, as a fraction of the budget
+#define TARGET 0.85f
+
+void DynamicResolution::setBudget(float milliseconds)
+{
+	if (milliseconds == m_budget)
+		return;
+	m_budget = milliseconds;
+	m_average = 0;
+	m_settle = 0;
+}
+
+bool DynamicResolution::update(float milliseconds)
+{
+	if (m_budget <= 0)
+		return false;
+	m_average = m_average == 0 ? milliseconds : m_average + AVERAGE_WEIGHT * (milliseconds - m_average);
+	if (m_settle > 0)
+	{
+		m_settle--;
+		return false;
+	}
+	if (m_average <= m_budget && (m_average >= RAISE_BELOW * m_budget || m_scale >= 1))
+		return false;
+
+	// rounded down to a step both ways: dropping overshoots a little and
+	// rising stays short of the budget
+	float scale = m_scale * sqrt(TARGET * m_budget / m_average);
+	scale = floor(scale / STEP) * STEP;
+	if (scale < MIN_SCALE)
+		scale = MIN_SCALE;
+	if (scale > 1)
+		scale = 1;
+	if (scale == m_scale)
+		return false;
+	m_scale = scale;
+	m_average = 0;
+	m_settle = SETTLE_FRAMES;
+	return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+// Picks the resolution scale that keeps frames within a time budget.
+//
+// Frame cost is taken to grow with the number of pixels, so the scale moves
+// by the square root of the budget's ratio to a running average of the frame
+// times. It drops as soon as the average goes over budget but only rises
+// again once frames take less than RAISE_BELOW of it, and it moves in steps
+// of STEP, so a load near the budget doesn't make it oscillate. After every
+// change a few frames are left to settle before measuring again.
+class DynamicResolution
+{
+	float m_budget;		// ms, 0 when off
+	float m_scale;
+	float m_average;	// ms, 0 before the first frame at this scale
+	int m_settle;		// frames to ignore after a change
+
+public:
+	static const float MIN_SCALE;
+	static const float STEP;
+	static const float RAISE_BELOW;
+	enum { SETTLE_FRAMES = 2 };
+
+	DynamicResolution() : m_budget(0), m_scale(1), m_average(0), m_settle(0) {}
+
+	// 0 turns the scaling off, getScale() then returns 1.
+	void setBudget(float milliseconds);
+	float getBudget() const { return m_budget; }
+	float getScale() const { return m_budget > 0 ? m_scale : 1.0f; }
+
+	// Feeds one frame's time. Returns true if the scale changed.
+	bool update(float milliseconds);
+};
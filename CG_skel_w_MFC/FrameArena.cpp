@@ -0,0 +1,139 @@
+#include "StdAfx.h"
+#include "FrameArena.h"
+#include <new>
+#include <cstdint>
+
+using namespace std;
+
+// smallest block taken from the system
+#define MIN_BLOCK (64u << 10)
+
+static inline char* AlignUp(char* p, size_t alignment)
+{
+	return (char*)(((uintptr_t)p + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+FrameArena::FrameArena(size_t capacity) : m_block(NULL), m_capacity(0), m_cursor(NULL), m_end(NULL),
+	m_frameBytes(0), m_peakBytes(0), m_systemCalls(0)
+{
+	if (capacity > 0)
+	{
+		m_block = (char*)::operator new(capacity);
+		m_systemCalls++;
+		m_capacity = capacity;
+		m_cursor = m_block;
+		m_end = m_block + capacity;
+	}
+}
+
+FrameArena::~FrameArena()
+{
+	for (size_t i = 0; i < m_overflow.size(); i++)
+		::operator delete(m_overflow[i]);
+	::operator delete(m_block);
+}
+
+void* FrameArena::allocate(size_t bytes, size_t alignment)
+{
+	char* p = AlignUp(m_cursor, alignment);
+	if (m_cursor == NULL || p + bytes > m_end)
+	{
+		grow(bytes, alignment);
+		p = AlignUp(m_cursor, alignment);
+	}
+	m_frameBytes += (p + bytes) - m_cursor;
+	m_cursor = p + bytes;
+	return p;
+}
+
+void FrameArena::grow(size_t bytes, size_t alignment)
+{
+	// at least double the previous block, to keep the warm-up short
+	size_t size = bytes + alignment;
+	if (size < m_capacity)
+		size = m_capacity;
+	if (!m_overflow.empty() && size < 2 * (size_t)(m_end - m_overflow.back()))
+		size = 2 * (size_t)(m_end - m_overflow.back());
+	if (size < MIN_BLOCK)
+		size = MIN_BLOCK;
+	char* block = (char*)::operator new(size);
+	m_systemCalls++;
+	m_overflow.push_back(block);
+	m_cursor = block;
+	m_end = block + size;
+}
+
+FrameArena::Marker FrameArena::mark() const
+{
+	Marker marker = { (int)m_overflow.size() - 1, m_cursor, m_frameBytes };
+	return marker;
+}
+
+void FrameArena::rewind(const Marker& marker)
+{
+	// memory in blocks taken since the mark stays in use until reset()
+	if (marker.block != (int)m_overflow.size() - 1)
+		return;
+	m_cursor = marker.cursor;
+	m_frameBytes = marker.frameBytes;
+}
+
+void FrameArena::reset()
+{
+	if (m_frameBytes > m_peakBytes)
+		m_peakBytes = m_frameBytes;
+
+	// the frame didn't fit: trade all its blocks for one that would have
+	if (!m_overflow.empty())
+	{
+		for (size_t i = 0; i < m_overflow.size(); i++)
+			::operator delete(m_overflow[i]);
+		m_systemCalls += (int)m_overflow.size();
+		m_overflow.clear();
+		if (m_block != NULL)
+		{
+			::operator delete(m_block);
+			m_systemCalls++;
+		}
+		m_capacity = m_peakBytes + m_peakBytes / 4;
+		m_block = (char*)::operator new(m_capacity);
+		m_systemCalls++;
+	}
+	m_cursor = m_block;
+	m_end = m_block + m_capacity;
+	m_frameBytes = 0;
+}
+
+FrameMemory::FrameMemory()
+{
+	setThreadCount(1);
+}
+
+FrameMemory::~FrameMemory()
+{
+	for (size_t i = 0; i < m_arenas.size(); i++)
+		delete m_arenas[i];
+}
+
+void FrameMemory::setThreadCount(int count)
+{
+	if (count < 1)
+		count = 1;
+	// arenas are only ever added, shrinking would throw their capacity away
+	while ((int)m_arenas.size() < count)
+		m_arenas.push_back(new FrameArena());
+}
+
+void FrameMemory::reset()
+{
+	for (size_t i = 0; i < m_arenas.size(); i++)
+		m_arenas[i]->reset();
+}
+
+int FrameMemory::getSystemCalls() const
+{
+	int calls = 0;
+	for (size_t i = 0; i < m_arenas.size(); i++)
+		calls += m_arenas[i]->getSystemCalls();
+	return calls;
+}
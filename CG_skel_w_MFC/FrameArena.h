@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+using namespace std;
+
+// Bump allocator for data that lives for one frame. allocate() only moves a
+// pointer and nothing is freed individually; reset() releases everything at
+// once. A frame that outgrows the block gets extra blocks from the system,
+// and the next reset() replaces them all by a single block big enough for
+// that frame, so a steady workload stops calling the heap after warm-up.
+// Blocks come from operator new, where AllocationCounter.h counts them.
+class FrameArena
+{
+	char* m_block;
+	size_t m_capacity;
+	char* m_cursor;
+	char* m_end;
+	vector<char*> m_overflow;	// blocks taken this frame, freed at reset
+	size_t m_frameBytes;		// handed out this frame, padding included
+	size_t m_peakBytes;
+	int m_systemCalls;		// blocks taken and given back since construction
+
+	void grow(size_t bytes, size_t alignment);
+
+	FrameArena(const FrameArena&);
+	FrameArena& operator=(const FrameArena&);
+
+public:
+	// Stack position, see mark() and rewind().
+	struct Marker
+	{
+		int block;	// -1 for the main block, else an overflow block
+		char* cursor;
+		size_t frameBytes;
+	};
+
+	explicit FrameArena(size_t capacity = 0);
+	~FrameArena();
+
+	void* allocate(size_t bytes, size_t alignment = 16);
+	template<class T> T* allocate(size_t count)
+	{
+		return static_cast<T*>(allocate(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16));
+	}
+
+	// Everything allocated after mark() can be given back early with
+	// rewind(), for scratch that doesn't need to last the whole frame.
+	Marker mark() const;
+	void rewind(const Marker& marker);
+
+	void reset();
+
+	size_t getFrameBytes() const { return m_frameBytes; }
+	size_t getPeakBytes() const { return m_peakBytes; }
+	size_t getCapacity() const { return m_capacity; }
+	int getSystemCalls() const { return m_systemCalls; }
+};
+
+// One arena per rendering thread, so workers never share a bump pointer.
+// All of them are reset together when the frame ends.
+class FrameMemory
+{
+	vector<FrameArena*> m_arenas;
+
+	FrameMemory(const FrameMemory&);
+	FrameMemory& operator=(const FrameMemory&);
+
+public:
+	FrameMemory();
+	~FrameMemory();
+
+	// Not thread safe; call before handing arenas to workers.
+	void setThreadCount(int count);
+	int getThreadCount() const { return (int)m_arenas.size(); }
+	FrameArena& arena(int thread) { return *m_arenas[thread]; }
+
+	void reset();
+
+	// heap calls made by the arenas so far; see AllocationCounter.h for
+	// those of the whole process
+	int getSystemCalls() const;
+};
@@ -0,0 +1,109 @@
+#include "StdAfx.h"
+#include "FrameBuffer.h"
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+
+using namespace std;
+
+// planes start on a cache line
+#define PLANE_ALIGNMENT 64
+
+static float* AllocPlane(size_t floats)
+{
+#ifdef _WIN32
+	return (float*)_aligned_malloc(floats * sizeof(float), PLANE_ALIGNMENT);
+#else
+	void* p = NULL;
+	return posix_memalign(&p, PLANE_ALIGNMENT, floats * sizeof(float)) == 0 ? (float*)p : NULL;
+#endif
+}
+
+static void FreePlane(float* plane)
+{
+#ifdef _WIN32
+	_aligned_free(plane);
+#else
+	free(plane);
+#endif
+}
+
+static inline int RoundUp(int value, int multiple)
+{
+	return (value + multiple - 1) / multiple * multiple;
+}
+
+FrameBuffer::FrameBuffer() : m_color(NULL), m_depth(NULL), m_depthFormat(DEPTH_FLOAT32), m_width(0), m_height(0),
+	m_stride(0), m_allocHeight(0), m_allocations(0)
+{
+}
+
+FrameBuffer::~FrameBuffer()
+{
+	release();
+}
+
+void FrameBuffer::release()
+{
+	FreePlane(m_color);
+	FreePlane(m_depth);
+	m_color = m_depth = NULL;
+	m_stride = m_allocHeight = 0;
+}
+
+bool FrameBuffer::resize(int width, int height, int reserveWidth, int reserveHeight)
+{
+	width = max(width, 1);
+	height = max(height, 1);
+	int needWidth = max(width, reserveWidth), needHeight = max(height, reserveHeight);
+
+	// fits, and doesn't waste most of the allocation: keep it
+	bool fits = needWidth <= m_stride && needHeight <= m_allocHeight;
+	bool wasteful = 4 * (long long)needWidth * needHeight < (long long)m_stride * m_allocHeight;
+	if (fits && !wasteful)
+	{
+		m_width = width;
+		m_height = height;
+		return false;
+	}
+
+	// a quarter of slack so a growing drag doesn't reallocate on every step
+	int allocWidth = RoundUp(RoundUp(needWidth + needWidth / 4, SIZE_STEP), ROW_ALIGN);
+	int allocHeight = RoundUp(needHeight + needHeight / 4, SIZE_STEP);
+	// both planes are taken before the old ones go, so running out of
+	// memory throws and leaves the buffer as it was
+	size_t pixels = (size_t)allocWidth * allocHeight;
+	float* color = AllocPlane(3 * pixels);
+	float* depth = color != NULL ? AllocPlane(pixels) : NULL;
+	if (depth == NULL)
+	{
+		FreePlane(color);
+		throw bad_alloc();
+	}
+	release();
+	m_color = color;
+	m_depth = depth;
+	m_width = width;
+	m_height = height;
+	m_stride = allocWidth;
+	m_allocHeight = allocHeight;
+	m_allocations++;
+	return true;
+}
+
+void FrameBuffer::clearColor(float value)
+{
+	fill(m_color, m_color + 3 * (size_t)m_stride * m_height, value);
+}
+
+void FrameBuffer::clearDepth(float value)
+{
+	size_t pixels = (size_t)m_stride * m_height;
+	if (m_depthFormat == DEPTH_UNORM16)
+	{
+		unsigned short* depth = (unsigned short*)m_depth;
+		fill(depth, depth + pixels, DepthTraits<DEPTH_UNORM16>::encode(value));
+	}
+	else
+		fill(m_depth, m_depth + pixels, value);
+}
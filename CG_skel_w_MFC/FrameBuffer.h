@@ -0,0 +1,62 @@
+#pragma once
+#include "Rasterizer.h"
+
+// Color (RGB floats) and depth planes of the software renderer.
+//
+// Storage is pooled: resize() keeps the current allocation whenever the new
+// size fits in it, and grows with some slack when it doesn't, so dragging a
+// window edge reallocates only every so often. The allocated area is rounded
+// up to multiples of SIZE_STEP pixels, which only coarsens the sizes it comes
+// in (the renderer's tiles stop at the frame's edge, not the storage's), and
+// rows are padded to a multiple of ROW_ALIGN pixels, which keeps every row of
+// both planes 16 byte aligned. Rows are getStride() pixels apart, not
+// getWidth().
+class FrameBuffer
+{
+	float* m_color;	// 3 * stride * allocated height
+	float* m_depth;	// stride * allocated height, room for the widest format
+	DepthFormat m_depthFormat;
+	int m_width, m_height;
+	int m_stride;		// allocated width, in pixels
+	int m_allocHeight;
+	int m_allocations;
+
+	void release();
+
+	FrameBuffer(const FrameBuffer&);
+	FrameBuffer& operator=(const FrameBuffer&);
+
+public:
+	enum { SIZE_STEP = 16, ROW_ALIGN = 4 };
+
+	FrameBuffer();
+	~FrameBuffer();
+
+	// Returns true if the storage had to be reallocated. The storage is kept
+	// large enough for the reserve size too, so drawing at a fraction of it
+	// and back doesn't reallocate. Throws bad_alloc, with the buffer left as
+	// it was, when the new storage can't be had.
+	bool resize(int width, int height, int reserveWidth = 0, int reserveHeight = 0);
+
+	float* color() { return m_color; }
+	// depth() is only meaningful for DEPTH_FLOAT32, depthData() for any format
+	float* depth() { return m_depth; }
+	void* depthData() { return m_depth; }
+	const float* color() const { return m_color; }
+	const float* depth() const { return m_depth; }
+	const void* depthData() const { return m_depth; }
+
+	// Doesn't reallocate; clear the depth after changing it.
+	void setDepthFormat(DepthFormat format) { m_depthFormat = format; }
+	DepthFormat getDepthFormat() const { return m_depthFormat; }
+
+	int getWidth() const { return m_width; }
+	int getHeight() const { return m_height; }
+	int getStride() const { return m_stride; }
+	int getAllocatedHeight() const { return m_allocHeight; }
+	int getAllocationCount() const { return m_allocations; }
+
+	// clear the visible rows, padding included; depth in [0,1]
+	void clearColor(float value);
+	void clearDepth(float value);
+};
@@ -0,0 +1,257 @@
+#include "StdAfx.h"
+#include "JobSystem.h"
+
+using namespace std;
+
+// jobs are allocated this many at a time and never freed before exit
+#define JOB_BLOCK 256
+
+struct Job
+{
+	JobFunction function;
+	void* data;
+	int begin, end;
+	JobCounter* counter;
+	Job* next;	// in the waiting list of a counter
+};
+
+// Double ended queue of jobs in a growable ring. The owner pushes and pops
+// at the back, thieves take from the front. A short lock per queue is
+// enough here: jobs are coarse, and the lock is almost never contended.
+class JobSystem::WorkQueue
+{
+	mutex m_lock;
+	vector<Job*> m_ring;	// power of two size
+	size_t m_head, m_tail;	// m_tail - m_head jobs, indices wrap
+
+public:
+	WorkQueue() : m_ring(64), m_head(0), m_tail(0) {}
+
+	void push(Job* job)
+	{
+		lock_guard<mutex> lock(m_lock);
+		size_t size = m_ring.size();
+		if (m_tail - m_head == size)
+		{
+			vector<Job*> ring(2 * size);
+			for (size_t i = m_head; i != m_tail; i++)
+				ring[i & (2 * size - 1)] = m_ring[i & (size - 1)];
+			m_ring.swap(ring);
+		}
+		m_ring[m_tail & (m_ring.size() - 1)] = job;
+		m_tail++;
+	}
+
+	Job* pop()
+	{
+		lock_guard<mutex> lock(m_lock);
+		if (m_head == m_tail)
+			return NULL;
+		m_tail--;
+		return m_ring[m_tail & (m_ring.size() - 1)];
+	}
+
+	Job* steal()
+	{
+		lock_guard<mutex> lock(m_lock);
+		if (m_head == m_tail)
+			return NULL;
+		Job* job = m_ring[m_head & (m_ring.size() - 1)];
+		m_head++;
+		return job;
+	}
+};
+
+static thread_local int t_slot = -1;
+
+JobSystem& JobSystem::instance()
+{
+	static JobSystem system;
+	return system;
+}
+
+JobSystem::JobSystem() : m_nextExternal(0), m_queued(0), m_quit(false)
+{
+	// the threads that wait on jobs help run them, so one core is left for them
+	int cores = (int)thread::hardware_concurrency();
+	m_workerCount = cores > 1 ? cores - 1 : 0;
+	for (int i = 0; i < m_workerCount + MAX_EXTERNAL_THREADS; i++)
+		m_queues.push_back(new WorkQueue());
+	m_nextExternal = m_workerCount;
+	for (int i = 0; i < m_workerCount; i++)
+		m_workers.push_back(thread(workerMain, this, i));
+}
+
+JobSystem::~JobSystem()
+{
+	{
+		lock_guard<mutex> lock(m_sleepLock);
+		m_quit = true;
+	}
+	m_wake.notify_all();
+	for (size_t i = 0; i < m_workers.size(); i++)
+		m_workers[i].join();
+	for (size_t i = 0; i < m_queues.size(); i++)
+		delete m_queues[i];
+	for (size_t i = 0; i < m_blocks.size(); i++)
+		delete[] m_blocks[i];
+}
+
+int JobSystem::currentSlot()
+{
+	if (t_slot < 0)
+	{
+		t_slot = m_nextExternal++;
+		if (t_slot >= (int)m_queues.size())
+		{
+			// more outside threads than slots: share the last one, which is
+			// safe for the queue but not for per slot scratch
+			t_slot = (int)m_queues.size() - 1;
+		}
+	}
+	return t_slot;
+}
+
+void JobSystem::workerMain(JobSystem* system, int slot)
+{
+	t_slot = slot;
+	for (;;)
+	{
+		Job* job = system->findJob(slot);
+		if (job != NULL)
+		{
+			system->execute(job);
+			continue;
+		}
+		unique_lock<mutex> lock(system->m_sleepLock);
+		while (system->m_queued.load() == 0 && !system->m_quit)
+			system->m_wake.wait(lock);
+		if (system->m_quit)
+			return;
+	}
+}
+
+Job* JobSystem::allocJob()
+{
+	lock_guard<mutex> lock(m_poolLock);
+	if (m_free.empty())
+	{
+		Job* block = new Job[JOB_BLOCK];
+		m_blocks.push_back(block);
+		for (int i = 0; i < JOB_BLOCK; i++)
+			m_free.push_back(&block[i]);
+	}
+	Job* job = m_free.back();
+	m_free.pop_back();
+	return job;
+}
+
+void JobSystem::freeJob(Job* job)
+{
+	lock_guard<mutex> lock(m_poolLock);
+	m_free.push_back(job);
+}
+
+void JobSystem::enqueue(Job* job)
+{
+	// counted first, so m_queued never drops below the jobs actually queued
+	m_queued++;
+	m_queues[currentSlot()]->push(job);
+	{
+		// pairs with the check in workerMain, so the wake up can't be missed
+		lock_guard<mutex> lock(m_sleepLock);
+	}
+	m_wake.notify_one();
+}
+
+Job* JobSystem::findJob(int slot)
+{
+	Job* job = m_queues[slot]->pop();
+	int count = (int)m_queues.size();
+	for (int i = 1; job == NULL && i < count; i++)
+		job = m_queues[(slot + i) % count]->steal();
+	if (job != NULL)
+		m_queued--;
+	return job;
+}
+
+void JobSystem::execute(Job* job)
+{
+	job->function(job->data, job->begin, job->end);
+	JobCounter* counter = job->counter;
+	freeJob(job);
+	finish(counter);
+}
+
+void JobSystem::finish(JobCounter* counter)
+{
+	// decremented under the lock: wait() takes it before returning, so the
+	// counter is never destroyed while this is still touching it
+	Job* waiting = NULL;
+	{
+		lock_guard<mutex> lock(counter->m_lock);
+		if (--counter->m_count == 0)
+		{
+			waiting = counter->m_waitingHead;
+			counter->m_waitingHead = counter->m_waitingTail = NULL;
+		}
+	}
+	// release the jobs that were waiting for this counter, in submission order
+	while (waiting != NULL)
+	{
+		Job* next = waiting->next;
+		enqueue(waiting);
+		waiting = next;
+	}
+}
+
+void JobSystem::run(JobFunction function, void* data, int begin, int end,
+	JobCounter& counter, JobCounter* after)
+{
+	Job* job = allocJob();
+	job->function = function;
+	job->data = data;
+	job->begin = begin;
+	job->end = end;
+	job->counter = &counter;
+	job->next = NULL;
+	counter.m_count++;
+
+	if (after != NULL)
+	{
+		lock_guard<mutex> lock(after->m_lock);
+		if (after->m_count.load() != 0)
+		{
+			if (after->m_waitingTail != NULL)
+				after->m_waitingTail->next = job;
+			else
+				after->m_waitingHead = job;
+			after->m_waitingTail = job;
+			return;
+		}
+	}
+	enqueue(job);
+}
+
+void JobSystem::parallelFor(JobFunction function, void* data, int count, int grain,
+	JobCounter& counter, JobCounter* after)
+{
+	if (grain < 1)
+		grain = 1;
+	for (int begin = 0; begin < count; begin += grain)
+		run(function, data, begin, begin + grain < count ? begin + grain : count, counter, after);
+}
+
+void JobSystem::wait(JobCounter& counter)
+{
+	int slot = currentSlot();
+	while (!counter.isDone())
+	{
+		Job* job = findJob(slot);
+		if (job != NULL)
+			execute(job);
+		else
+			this_thread::yield();
+	}
+	lock_guard<mutex> lock(counter.m_lock);
+}
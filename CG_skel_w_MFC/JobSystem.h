@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+
+using namespace std;
+
+// Work function of a job. Jobs made by parallelFor() get a sub-range of the
+// loop, others get whatever range they were submitted with.
+typedef void (*JobFunction)(void* data, int begin, int end);
+
+struct Job;
+
+// Counts unfinished jobs. Every job is submitted against a counter, can be
+// made to wait for another counter to reach zero first, and callers block on
+// a counter with JobSystem::wait(). A counter must outlive its jobs.
+class JobCounter
+{
+	atomic<int> m_count;
+	mutex m_lock;
+	// jobs to start once this reaches zero, linked through Job::next so
+	// that counters, usually locals, never touch the heap
+	Job* m_waitingHead;
+	Job* m_waitingTail;
+
+	friend class JobSystem;
+
+	JobCounter(const JobCounter&);
+	JobCounter& operator=(const JobCounter&);
+
+public:
+	JobCounter() : m_count(0), m_waitingHead(NULL), m_waitingTail(NULL) {}
+	bool isDone() const { return m_count.load() == 0; }
+};
+
+// Work stealing scheduler, one per process, sized to the hardware.
+//
+// Every thread that touches the system owns a slot with a queue: the pool's
+// worker threads take the first slots, other threads (the one driving the
+// frame, a loader) get one of a few extra slots the first time they submit
+// or wait. Threads pop their own queue from the back and steal from the
+// front of the others. A waiting thread runs jobs instead of blocking, so
+// jobs may submit and wait on further jobs.
+class JobSystem
+{
+	class WorkQueue;
+
+	vector<WorkQueue*> m_queues;	// one per slot
+	vector<thread> m_workers;
+	atomic<int> m_nextExternal;
+	int m_workerCount;
+
+	// idle workers sleep until something is queued
+	mutex m_sleepLock;
+	condition_variable m_wake;
+	atomic<int> m_queued;
+	bool m_quit;
+
+	// recycled jobs, allocated in blocks
+	mutex m_poolLock;
+	vector<Job*> m_free;
+	vector<Job*> m_blocks;
+
+	JobSystem();
+	~JobSystem();
+	JobSystem(const JobSystem&);
+	JobSystem& operator=(const JobSystem&);
+
+	static void workerMain(JobSystem* system, int slot);
+	Job* allocJob();
+	void freeJob(Job* job);
+	void enqueue(Job* job);
+	Job* findJob(int slot);
+	void execute(Job* job);
+	void finish(JobCounter* counter);
+
+public:
+	// threads outside the pool that may use the system at the same time
+	enum { MAX_EXTERNAL_THREADS = 4 };
+
+	static JobSystem& instance();
+
+	// Queues function(data, begin, end) against counter. When after is given
+	// the job only starts once after has no unfinished jobs left.
+	void run(JobFunction function, void* data, int begin, int end,
+		JobCounter& counter, JobCounter* after = NULL);
+
+	// Splits [0, count) into chunks of about grain iterations, one job each.
+	void parallelFor(JobFunction function, void* data, int count, int grain,
+		JobCounter& counter, JobCounter* after = NULL);
+
+	// Returns once counter is done, running queued jobs meanwhile.
+	void wait(JobCounter& counter);
+
+	// Slot of the calling thread, in [0, getSlotCount()). Stable for the
+	// lifetime of the thread; use it to index per thread scratch.
+	int currentSlot();
+	int getSlotCount() const { return (int)m_queues.size(); }
+	int getWorkerCount() const { return m_workerCount; }
+};
@@ -0,0 +1,387 @@
+#pragma once
+#include <cmath>
+#include <emmintrin.h>
+
+using namespace std;
+
+// Lighting of the software renderer: directional, point and spot lights
+// with Phong or Blinn-Phong reflection. Surfaces are shaded SHADE_BATCH at a
+// time, every value held in a pair of SSE registers, and the same kernel
+// lights vertices (Gouraud) and pixels. Like Rasterizer.h it depends on
+// neither GL nor the renderer's types.
+
+enum LightType { LIGHT_DIRECTIONAL, LIGHT_POINT, LIGHT_SPOT };
+enum ReflectionModel { REFLECT_PHONG, REFLECT_BLINN_PHONG };
+
+enum { SHADE_BATCH = 8 };
+
+// A light in world space, as the kernel reads it.
+struct ShadingLight
+{
+	LightType type;
+	float position[3];	// point and spot
+	float direction[3];	// directional and spot: where the light shines, unit length
+	float color[3];		// times intensity
+	float range;		// point and spot: the light fades out to nothing here
+	float invRangeSquared;
+	float cosOuter;		// spot: cosine of the cone's half angle
+	float spotScale;	// spot: 1 / (cosInner - cosOuter), full intensity inside cosInner
+	int shadow;		// into ShadingContext::shadows, -1 for none
+};
+
+// A light's depth as seen from it, size x size floats in [0,1], rows from
+// the bottom. The matrix takes world space points to the map: x and y in
+// texels and z in depth, after dividing by w.
+struct ShadowMap
+{
+	const float* depth;
+	int size;
+	float matrix[4][4];	// row major
+	float normalOffset;	// world size of a texel at w = 1
+	float bias;		// depth
+};
+
+// What the kernel needs besides the surfaces. The lights shaded with are
+// lights[list[i]] for i < count, or the first count lights without a list.
+struct ShadingContext
+{
+	const ShadingLight* lights;
+	const int* list;
+	int count;
+	const ShadowMap* shadows;	// of lights with shadow >= 0
+	float eye[3];
+	float ambient[3];
+	ReflectionModel model;
+};
+
+// SHADE_BATCH surface points in world space, one array per component.
+// Normals needn't be unit length. All lanes are shaded: fill the ones
+// without a surface with anything finite.
+struct SurfaceBatch
+{
+	float px[SHADE_BATCH], py[SHADE_BATCH], pz[SHADE_BATCH];
+	float nx[SHADE_BATCH], ny[SHADE_BATCH], nz[SHADE_BATCH];
+	float albedo[3][SHADE_BATCH];
+	float specular[SHADE_BATCH];
+	float shininess[SHADE_BATCH];
+	float color[3][SHADE_BATCH];	// the result
+};
+
+// The eight lanes of a batch.
+struct Float8
+{
+	__m128 lo, hi;
+
+	Float8() {}
+	Float8(__m128 lo, __m128 hi) : lo(lo), hi(hi) {}
+	explicit Float8(float f) : lo(_mm_set1_ps(f)), hi(lo) {}
+	static Float8 load(const float* p) { return Float8(_mm_loadu_ps(p), _mm_loadu_ps(p + 4)); }
+	void store(float* p) const { _mm_storeu_ps(p, lo); _mm_storeu_ps(p + 4, hi); }
+};
+
+inline Float8 operator+(Float8 a, Float8 b) { return Float8(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)); }
+inline Float8 operator-(Float8 a, Float8 b) { return Float8(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)); }
+inline Float8 operator*(Float8 a, Float8 b) { return Float8(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)); }
+inline Float8 operator/(Float8 a, Float8 b) { return Float8(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)); }
+inline Float8 operator&(Float8 a, Float8 b) { return Float8(_mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi)); }
+inline Float8 Min8(Float8 a, Float8 b) { return Float8(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)); }
+inline Float8 Max8(Float8 a, Float8 b) { return Float8(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)); }
+inline Float8 Greater8(Float8 a, Float8 b) { return Float8(_mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi)); }
+// a where the mask is set, b elsewhere
+inline Float8 Select8(Float8 mask, Float8 a, Float8 b)
+{
+	return Float8(_mm_or_ps(_mm_and_ps(mask.lo, a.lo), _mm_andnot_ps(mask.lo, b.lo)), _mm_or_ps(_mm_and_ps(mask.hi, a.hi), _mm_andnot_ps(mask.hi, b.hi)));
+}
+inline bool Any8(Float8 mask) { return (_mm_movemask_ps(mask.lo) | _mm_movemask_ps(mask.hi)) != 0; }
+inline Float8 Saturate8(Float8 a) { return Min8(Max8(a, Float8(0.0f)), Float8(1.0f)); }
+
+// 1/sqrt(a), with one Newton-Raphson step on the estimate
+inline __m128 InvSqrt4(__m128 a)
+{
+	__m128 r = _mm_rsqrt_ps(a);
+	return _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), r), _mm_sub_ps(_mm_set1_ps(3.0f), _mm_mul_ps(_mm_mul_ps(a, r), r)));
+}
+inline Float8 InvSqrt8(Float8 a) { return Float8(InvSqrt4(a.lo), InvSqrt4(a.hi)); }
+
+// log2 and exp2 by minimax polynomials, for pow(x, shininess) in specular
+// highlights; within about 1e-4 of pow().
+inline __m128 Log2_4(__m128 x)
+{
+	__m128i i = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(_mm_and_si128(i, _mm_set1_epi32(0x7F800000)), 23), _mm_set1_epi32(127)));
+	__m128 one = _mm_set1_ps(1.0f);
+	__m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(i, _mm_set1_epi32(0x007FFFFF))), one);
+	// log2(m) / (m - 1) for m in [1, 2)
+	__m128 p = _mm_set1_ps(-3.4436006e-2f);
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(3.1821337e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-1.2315303f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(2.5988452f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(-3.3241990f));
+	p = _mm_add_ps(_mm_mul_ps(p, m), _mm_set1_ps(3.1157899f));
+	return _mm_add_ps(_mm_mul_ps(p, _mm_sub_ps(m, one)), e);
+}
+
+inline __m128 Exp2_4(__m128 x)
+{
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(129.0f)), _mm_set1_ps(-126.99999f));
+	__m128i ipart = _mm_cvtps_epi32(_mm_sub_ps(x, _mm_set1_ps(0.5f)));
+	__m128 f = _mm_sub_ps(x, _mm_cvtepi32_ps(ipart));
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(ipart, _mm_set1_epi32(127)), 23));
+	// 2^f for f in [0, 1)
+	__m128 p = _mm_set1_ps(1.8775767e-3f);
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(8.9893397e-3f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(5.5826318e-2f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(2.4015361e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(6.9315308e-1f));
+	p = _mm_add_ps(_mm_mul_ps(p, f), _mm_set1_ps(9.9999994e-1f));
+	return _mm_mul_ps(scale, p);
+}
+
+// x^y for x >= 0
+inline Float8 Pow8(Float8 x, Float8 y)
+{
+	return Float8(Exp2_4(_mm_mul_ps(Log2_4(x.lo), y.lo)), Exp2_4(_mm_mul_ps(Log2_4(x.hi), y.hi)));
+}
+
+inline Float8 Dot8(Float8 ax, Float8 ay, Float8 az, Float8 bx, Float8 by, Float8 bz)
+{
+	return ax * bx + ay * by + az * bz;
+}
+
+inline void Normalize8(Float8& x, Float8& y, Float8& z)
+{
+	// zero vectors stay zero
+	Float8 s = InvSqrt8(Max8(Dot8(x, y, z, x, y, z), Float8(1e-30f)));
+	x = x * s;  y = y * s;  z = z * s;
+}
+
+// Fraction of the light reaching each lane past the shadow map's casters,
+// by percentage-closer filtering: the 3x3 texels around the lane's are each
+// compared with its depth and the results averaged. Points are first
+// pushed out along their unit normal by a texel and a half, which keeps
+// surfaces from shadowing themselves at grazing angles. Lanes outside the
+// map are lit. The depths are gathered one lane at a time, the rest is
+// done for all eight at once.
+inline Float8 Shadow8(const ShadowMap& map, Float8 px, Float8 py, Float8 pz, Float8 nx, Float8 ny, Float8 nz)
+{
+	const float (*m)[4] = map.matrix;
+	Float8 zero(0.0f), one(1.0f);
+	Float8 w = Float8(m[3][0]) * px + Float8(m[3][1]) * py + Float8(m[3][2]) * pz + Float8(m[3][3]);
+	Float8 offset = w * Float8(1.5f * map.normalOffset);
+	px = px + nx * offset;  py = py + ny * offset;  pz = pz + nz * offset;
+	w = Float8(m[3][0]) * px + Float8(m[3][1]) * py + Float8(m[3][2]) * pz + Float8(m[3][3]);
+	Float8 inside = Greater8(w, Float8(1e-30f));
+	Float8 invW = one / Select8(inside, w, one);
+	Float8 x = (Float8(m[0][0]) * px + Float8(m[0][1]) * py + Float8(m[0][2]) * pz + Float8(m[0][3])) * invW;
+	Float8 y = (Float8(m[1][0]) * px + Float8(m[1][1]) * py + Float8(m[1][2]) * pz + Float8(m[1][3])) * invW;
+	Float8 z = (Float8(m[2][0]) * px + Float8(m[2][1]) * py + Float8(m[2][2]) * pz + Float8(m[2][3])) * invW - Float8(map.bias);
+	Float8 size((float)map.size);
+	inside = inside & Greater8(x, zero) & Greater8(size, x) & Greater8(y, zero) & Greater8(size, y) & Greater8(one, z);
+	if (!Any8(inside))
+		return one;
+
+	// inside lanes are positive, so truncating is flooring
+	Float8 last((float)(map.size - 1));
+	x = Min8(Max8(x, zero), last);
+	y = Min8(Max8(y, zero), last);
+	int ix[SHADE_BATCH], iy[SHADE_BATCH];
+	_mm_storeu_si128((__m128i*)ix, _mm_cvttps_epi32(x.lo));
+	_mm_storeu_si128((__m128i*)(ix + 4), _mm_cvttps_epi32(x.hi));
+	_mm_storeu_si128((__m128i*)iy, _mm_cvttps_epi32(y.lo));
+	_mm_storeu_si128((__m128i*)(iy + 4), _mm_cvttps_epi32(y.hi));
+	const float* rows[3][SHADE_BATCH];
+	int columns[3][SHADE_BATCH];
+	for (int j = 0; j < SHADE_BATCH; j++)
+		for (int d = 0; d < 3; d++)
+		{
+			int tx = ix[j] + d - 1, ty = iy[j] + d - 1;
+			columns[d][j] = tx < 0 ? 0 : tx >= map.size ? map.size - 1 : tx;
+			rows[d][j] = map.depth + (ty < 0 ? 0 : ty >= map.size ? map.size - 1 : ty) * map.size;
+		}
+
+	Float8 lit = zero;
+	for (int dy = 0; dy < 3; dy++)
+		for (int dx = 0; dx < 3; dx++)
+		{
+			float depth[SHADE_BATCH];
+			for (int j = 0; j < SHADE_BATCH; j++)
+				depth[j] = rows[dy][j][columns[dx][j]];
+			lit = lit + (Greater8(Float8::load(depth), z) & one);
+		}
+	return Select8(inside, lit * Float8(1.0f / 9), one);
+}
+
+// Lights the batch: ambient * albedo plus, for every light, its color times
+// attenuation times albedo * max(N.L, 0) + specular * specular term, the
+// term being max(R.V, 0)^shininess (Phong) or max(N.H, 0)^shininess
+// (Blinn-Phong). Point and spot light falls off as (1 - d^2 / range^2)^2,
+// and spot light between the outer and inner cone by smoothstep. Lights
+// with a shadow map are scaled by Shadow8. Lights that reach none of the
+// lanes cost a few compares.
+inline void ShadeBatch(const ShadingContext& context, SurfaceBatch& s)
+{
+	Float8 px = Float8::load(s.px), py = Float8::load(s.py), pz = Float8::load(s.pz);
+	Float8 nx = Float8::load(s.nx), ny = Float8::load(s.ny), nz = Float8::load(s.nz);
+	Normalize8(nx, ny, nz);
+	Float8 vx = Float8(context.eye[0]) - px, vy = Float8(context.eye[1]) - py, vz = Float8(context.eye[2]) - pz;
+	Normalize8(vx, vy, vz);
+	Float8 albedo[3] = { Float8::load(s.albedo[0]), Float8::load(s.albedo[1]), Float8::load(s.albedo[2]) };
+	Float8 specular = Float8::load(s.specular), shininess = Float8::load(s.shininess);
+	Float8 zero(0.0f), one(1.0f);
+
+	Float8 diffuseSum[3], specularSum[3];
+	for (int k = 0; k < 3; k++)
+		diffuseSum[k] = specularSum[k] = zero;
+	for (int i = 0; i < context.count; i++)
+	{
+		const ShadingLight& light = context.lights[context.list != NULL ? context.list[i] : i];
+		Float8 lx, ly, lz, attenuation;
+		if (light.type == LIGHT_DIRECTIONAL)
+		{
+			lx = Float8(-light.direction[0]);  ly = Float8(-light.direction[1]);  lz = Float8(-light.direction[2]);
+			attenuation = one;
+		}
+		else
+		{
+			lx = Float8(light.position[0]) - px;  ly = Float8(light.position[1]) - py;  lz = Float8(light.position[2]) - pz;
+			Float8 distanceSquared = Dot8(lx, ly, lz, lx, ly, lz);
+			Float8 fade = Saturate8(one - distanceSquared * Float8(light.invRangeSquared));
+			attenuation = fade * fade;
+			if (!Any8(Greater8(attenuation, zero)))
+				continue;
+			Float8 inv = InvSqrt8(Max8(distanceSquared, Float8(1e-30f)));
+			lx = lx * inv;  ly = ly * inv;  lz = lz * inv;
+			if (light.type == LIGHT_SPOT)
+			{
+				Float8 cosAngle = zero - Dot8(lx, ly, lz, Float8(light.direction[0]), Float8(light.direction[1]), Float8(light.direction[2]));
+				Float8 t = Saturate8((cosAngle - Float8(light.cosOuter)) * Float8(light.spotScale));
+				attenuation = attenuation * t * t * (Float8(3.0f) - Float8(2.0f) * t);
+				if (!Any8(Greater8(attenuation, zero)))
+					continue;
+			}
+		}
+
+		Float8 nDotL = Dot8(nx, ny, nz, lx, ly, lz);
+		Float8 lit = Greater8(nDotL, zero);
+		if (!Any8(lit))
+			continue;
+		if (light.shadow >= 0)
+			attenuation = attenuation * Shadow8(context.shadows[light.shadow], px, py, pz, nx, ny, nz);
+		Float8 base;
+		if (context.model == REFLECT_PHONG)
+		{
+			// R = 2 (N.L) N - L
+			Float8 twice = nDotL + nDotL;
+			base = Dot8(twice * nx - lx, twice * ny - ly, twice * nz - lz, vx, vy, vz);
+		}
+		else
+		{
+			Float8 hx = lx + vx, hy = ly + vy, hz = lz + vz;
+			Normalize8(hx, hy, hz);
+			base = Dot8(nx, ny, nz, hx, hy, hz);
+		}
+		Float8 highlight = Pow8(Max8(base, zero), shininess) & lit;
+		Float8 diffuse = Max8(nDotL, zero) * attenuation;
+		highlight = highlight * attenuation;
+		for (int k = 0; k < 3; k++)
+		{
+			Float8 color(light.color[k]);
+			diffuseSum[k] = diffuseSum[k] + color * diffuse;
+			specularSum[k] = specularSum[k] + color * highlight;
+		}
+	}
+	for (int k = 0; k < 3; k++)
+		(albedo[k] * (Float8(context.ambient[k]) + diffuseSum[k]) + specular * specularSum[k]).store(s.color[k]);
+}
+
+// Shadow8 for one point, with a unit normal.
+inline float ShadowScalar(const ShadowMap& map, const float* p, const float* n)
+{
+	const float (*m)[4] = map.matrix;
+	float w = m[3][0] * p[0] + m[3][1] * p[1] + m[3][2] * p[2] + m[3][3];
+	float offset = w * 1.5f * map.normalOffset;
+	float q[3] = { p[0] + n[0] * offset, p[1] + n[1] * offset, p[2] + n[2] * offset };
+	w = m[3][0] * q[0] + m[3][1] * q[1] + m[3][2] * q[2] + m[3][3];
+	if (!(w > 1e-30f))
+		return 1;
+	float x = (m[0][0] * q[0] + m[0][1] * q[1] + m[0][2] * q[2] + m[0][3]) / w;
+	float y = (m[1][0] * q[0] + m[1][1] * q[1] + m[1][2] * q[2] + m[1][3]) / w;
+	float z = (m[2][0] * q[0] + m[2][1] * q[1] + m[2][2] * q[2] + m[2][3]) / w - map.bias;
+	if (!(x > 0 && x < map.size && y > 0 && y < map.size && z < 1))
+		return 1;
+	int ix = (int)x, iy = (int)y, lit = 0;
+	for (int ty = iy - 1; ty <= iy + 1; ty++)
+		for (int tx = ix - 1; tx <= ix + 1; tx++)
+		{
+			int cx = (std::min)((std::max)(tx, 0), map.size - 1), cy = (std::min)((std::max)(ty, 0), map.size - 1);
+			if (map.depth[cy * map.size + cx] > z)
+				lit++;
+		}
+	return lit / 9.0f;
+}
+
+// The same, one lane at a time with the standard library's math; the
+// reference ShadeBatch is checked and measured against.
+inline void ShadeBatchScalar(const ShadingContext& context, SurfaceBatch& s)
+{
+	for (int j = 0; j < SHADE_BATCH; j++)
+	{
+		float p[3] = { s.px[j], s.py[j], s.pz[j] };
+		float n[3] = { s.nx[j], s.ny[j], s.nz[j] };
+		float v[3] = { context.eye[0] - p[0], context.eye[1] - p[1], context.eye[2] - p[2] };
+		float nLength = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]), vLength = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+		for (int k = 0; k < 3; k++)
+		{
+			n[k] = nLength > 0 ? n[k] / nLength : 0;
+			v[k] = vLength > 0 ? v[k] / vLength : 0;
+		}
+		float diffuseSum[3] = { 0, 0, 0 }, specularSum[3] = { 0, 0, 0 };
+		for (int i = 0; i < context.count; i++)
+		{
+			const ShadingLight& light = context.lights[context.list != NULL ? context.list[i] : i];
+			float l[3], attenuation = 1;
+			if (light.type == LIGHT_DIRECTIONAL)
+				for (int k = 0; k < 3; k++)
+					l[k] = -light.direction[k];
+			else
+			{
+				for (int k = 0; k < 3; k++)
+					l[k] = light.position[k] - p[k];
+				float distanceSquared = l[0] * l[0] + l[1] * l[1] + l[2] * l[2];
+				float fade = (std::min)((std::max)(1 - distanceSquared * light.invRangeSquared, 0.0f), 1.0f);
+				attenuation = fade * fade;
+				float distance = sqrt(distanceSquared);
+				for (int k = 0; k < 3; k++)
+					l[k] = distance > 0 ? l[k] / distance : 0;
+				if (light.type == LIGHT_SPOT)
+				{
+					float cosAngle = -(l[0] * light.direction[0] + l[1] * light.direction[1] + l[2] * light.direction[2]);
+					float t = (std::min)((std::max)((cosAngle - light.cosOuter) * light.spotScale, 0.0f), 1.0f);
+					attenuation *= t * t * (3 - 2 * t);
+				}
+			}
+			float nDotL = n[0] * l[0] + n[1] * l[1] + n[2] * l[2];
+			if (nDotL <= 0 || attenuation <= 0)
+				continue;
+			if (light.shadow >= 0)
+				attenuation *= ShadowScalar(context.shadows[light.shadow], p, n);
+			float base;
+			if (context.model == REFLECT_PHONG)
+				base = (2 * nDotL * n[0] - l[0]) * v[0] + (2 * nDotL * n[1] - l[1]) * v[1] + (2 * nDotL * n[2] - l[2]) * v[2];
+			else
+			{
+				float h[3] = { l[0] + v[0], l[1] + v[1], l[2] + v[2] };
+				float hLength = sqrt(h[0] * h[0] + h[1] * h[1] + h[2] * h[2]);
+				base = hLength > 0 ? (n[0] * h[0] + n[1] * h[1] + n[2] * h[2]) / hLength : 0;
+			}
+			float highlight = pow((std::max)(base, 0.0f), s.shininess[j]) * attenuation;
+			for (int k = 0; k < 3; k++)
+			{
+				diffuseSum[k] += light.color[k] * nDotL * attenuation;
+				specularSum[k] += light.color[k] * highlight;
+			}
+		}
+		for (int k = 0; k < 3; k++)
+			s.color[k][j] = s.albedo[k][j] * (context.ambient[k] + diffuseSum[k]) + s.specular[j] * specularSum[k];
+	}
+}
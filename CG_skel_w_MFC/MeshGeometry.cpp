@@ -0,0 +1,160 @@
+#include "StdAfx.h"
+#include "MeshGeometry.h"
+#include "vec.h"
+#include "JobSystem.h"
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+using namespace std;
+
+struct FaceIdcs
+{
+	int v[4];
+	int vn[4];
+	int vt[4];
+
+	FaceIdcs()
+	{
+		for (int i=0; i<4; i++)
+			v[i] = vn[i] = vt[i] = 0;
+	}
+
+	FaceIdcs(std::istream & aStream)
+	{
+		for (int i=0; i<4; i++)
+			v[i] = vn[i] = vt[i] = 0;
+
+		char c;
+		for(int i = 0; i < 3; i++)
+		{
+			aStream >> std::ws >> v[i] >> std::ws;
+			if (aStream.peek() != '/')
+				continue;
+			aStream >> c >> std::ws;
+			if (aStream.peek() == '/')
+			{
+				aStream >> c >> std::ws >> vn[i];
+				continue;
+			}
+			else
+				aStream >> vt[i];
+			if (aStream.peek() != '/')
+				continue;
+			aStream >> c >> vn[i];
+		}
+	}
+};
+
+static vec3 vec3fFromStream(std::istream & aStream)
+{
+	float x, y, z;
+	aStream >> x >> std::ws >> y >> std::ws >> z;
+	return vec3(x, y, z);
+}
+
+struct TriangleAssembly
+{
+	const vector<FaceIdcs>* faces;
+	const vector<vec3>* vertices;
+	const vector<vec3>* normals;
+	MeshGeometry* mesh;
+};
+
+static void assembleTriangles(void* data, int begin, int end)
+{
+	const TriangleAssembly& a = *(const TriangleAssembly*)data;
+	const vector<vec3>& vertices = *a.vertices;
+	const vector<vec3>& normals = *a.normals;
+	for (int f = begin; f < end; f++)
+	{
+		const FaceIdcs& face = (*a.faces)[f];
+		// get three vertices of current FaceIdcs (obj indices are 1-based)
+		vec3 p[3];
+		for (int i = 0; i < 3; i++)
+		{
+			int v = face.v[i] - 1;
+			p[i] = (v >= 0 && v < (int)vertices.size()) ? vertices[v] : vec3();
+			a.mesh->vertex_positions[3*f+i] = p[i];
+		}
+
+		vec3 faceNormal = cross(p[1] - p[0], p[2] - p[0]);
+		GLfloat len = length(faceNormal);
+		if (len > 0)
+			faceNormal = faceNormal / len;
+		for (int i = 0; i < 3; i++)
+		{
+			int vn = face.vn[i] - 1;
+			a.mesh->vertex_normals[3*f+i] = (vn >= 0 && vn < (int)normals.size()) ? normals[vn] : faceNormal;
+		}
+	}
+}
+
+void MeshGeometry::loadFile(string fileName)
+{
+	ifstream ifile(fileName.c_str());
+	vector<FaceIdcs> faces;
+	vector<vec3> vertices;
+	vector<vec3> normals;
+	// while not end of file
+	while (!ifile.eof())
+	{
+		// get line
+		string curLine;
+		getline(ifile, curLine);
+
+		// read type of the line
+		istringstream issLine(curLine);
+		string lineType;
+
+		issLine >> std::ws >> lineType;
+
+		// based on the type parse data
+		if (lineType == "v")
+			vertices.push_back(vec3fFromStream(issLine));
+		else if (lineType == "vn")
+			normals.push_back(vec3fFromStream(issLine));
+		else if (lineType == "f")
+			faces.push_back(issLine);
+		else if (lineType == "#" || lineType == "" || lineType == "vt" ||
+			lineType == "g" || lineType == "o" || lineType == "s" ||
+			lineType == "usemtl" || lineType == "mtllib")
+		{
+			// comment / empty line / attributes we don't use
+		}
+		else
+		{
+			cout<< "Found unknown line Type \"" << lineType << "\"";
+		}
+	}
+	//vertex_positions is an array of vec3. Every three elements define a triangle in 3D.
+	//If the face part of the obj is
+	//f 1 2 3
+	//f 1 3 4
+	//Then vertex_positions should contain:
+	//vertex_positions={v1,v2,v3,v1,v3,v4}
+
+	vertex_positions.resize(3*faces.size());
+	vertex_normals.resize(3*faces.size());
+	// triangles are independent, build them in parallel
+	TriangleAssembly assembly = { &faces, &vertices, &normals, this };
+	JobSystem& jobs = JobSystem::instance();
+	JobCounter assembled;
+	jobs.parallelFor(assembleTriangles, &assembly, (int)faces.size(), 16384, assembled);
+	jobs.wait(assembled);
+
+	bbox_min = bbox_max = vertex_positions.empty() ? vec3() : vertex_positions[0];
+	for (size_t i = 1; i < vertex_positions.size(); i++)
+	{
+		const vec3& p = vertex_positions[i];
+		bbox_min = vec3(min(bbox_min.x, p.x), min(bbox_min.y, p.y), min(bbox_min.z, p.z));
+		bbox_max = vec3(max(bbox_max.x, p.x), max(bbox_max.y, p.y), max(bbox_max.z, p.z));
+	}
+}
+
+size_t MeshGeometry::memorySize() const
+{
+	return sizeof(*this) + (vertex_positions.capacity() + vertex_normals.capacity()) * sizeof(vec3);
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include "vec.h"
+#include <vector>
+#include <string>
+#include <memory>
+
+using namespace std;
+
+// Vertex data of one OBJ file. Immutable once loaded and shared by reference
+// between all the MeshModel instances that place it in the scene.
+class MeshGeometry
+{
+public:
+	//Every three elements define a triangle in 3D.
+	vector<vec3> vertex_positions;
+	//Same length as vertex_positions. Face normals when the file has none.
+	vector<vec3> vertex_normals;
+	//Object space bounding box.
+	vec3 bbox_min, bbox_max;
+
+	MeshGeometry() {}
+	void loadFile(string fileName);
+	size_t memorySize() const;
+};
+
+typedef shared_ptr<const MeshGeometry> MeshGeometryPtr;
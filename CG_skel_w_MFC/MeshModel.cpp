@@ -2,67 +2,16 @@
 #include "MeshModel.h"
 #include "vec.h"
 #include <string>
-#include <iostream>
-#include <fstream>
-#include <sstream>
 
 using namespace std;
 
-struct FaceIdcs
-{
-	int v[4];
-	int vn[4];
-	int vt[4];
-
-	FaceIdcs()
-	{
-		for (int i=0; i<4; i++)
-			v[i] = vn[i] = vt[i] = 0;
-	}
-
-	FaceIdcs(std::istream & aStream)
-	{
-		for (int i=0; i<4; i++)
-			v[i] = vn[i] = vt[i] = 0;
-
-		char c;
-		for(int i = 0; i < 3; i++)
-		{
-			aStream >> std::ws >> v[i] >> std::ws;
-			if (aStream.peek() != '/')
-				continue;
-			aStream >> c >> std::ws;
-			if (aStream.peek() == '/')
-			{
-				aStream >> c >> std::ws >> vn[i];
-				continue;
-			}
-			else
-				aStream >> vt[i];
-			if (aStream.peek() != '/')
-				continue;
-			aStream >> c >> vn[i];
-		}
-	}
-};
-
-vec3 vec3fFromStream(std::istream & aStream)
+MeshModel::MeshModel(string fileName)
 {
-	float x, y, z;
-	aStream >> x >> std::ws >> y >> std::ws >> z;
-	return vec3(x, y, z);
+	loadFile(fileName);
 }
 
-vec2 vec2fFromStream(std::istream & aStream)
+MeshModel::MeshModel(MeshGeometryPtr geometry) : _geometry(geometry)
 {
-	float x, y;
-	aStream >> x >> std::ws >> y;
-	return vec2(x, y);
-}
-
-MeshModel::MeshModel(string fileName)
-{
-	loadFile(fileName);
 }
 
 MeshModel::~MeshModel(void)
@@ -71,60 +20,13 @@ MeshModel::~MeshModel(void)
 
 void MeshModel::loadFile(string fileName)
 {
-	ifstream ifile(fileName.c_str());
-	vector<FaceIdcs> faces;
-	vector<vec3> vertices;
-	// while not end of file
-	while (!ifile.eof())
-	{
-		// get line
-		string curLine;
-		getline(ifile, curLine);
-
-		// read type of the line
-		istringstream issLine(curLine);
-		string lineType;
-
-		issLine >> std::ws >> lineType;
-
-		// based on the type parse data
-		if (lineType == "?") /*BUG*/
-			vertices.push_back(vec3fFromStream(issLine));
-		else if (lineType == "?") /*BUG*/
-			faces.push_back(issLine);
-		else if (lineType == "#" || lineType == "")
-		{
-			// comment / empty line
-		}
-		else
-		{
-			cout<< "Found unknown line Type \"" << lineType << "\"";
-		}
-	}
-	//Vertex_positions is an array of vec3. Every three elements define a triangle in 3D.
-	//If the face part of the obj is
-	//f 1 2 3
-	//f 1 3 4
-	//Then vertex_positions should contain:
-	//vertex_positions={v1,v2,v3,v1,v3,v4}
-
-	vertex_positions = new vec3[7]; /*BUG*/
-	// iterate through all stored faces and create triangles
-	int k=0;
-	for (vector<FaceIdcs>::iterator it = faces.begin(); it != faces.end(); ++it)
-	{
-		// get three vertices of current FaceIdcs 
-		
-		for (int i = 0; i < 3; i++)
-		{
-			vertex_positions[k++] = vec3(); /*BUG*/
-		}
-	}
+	shared_ptr<MeshGeometry> geometry(new MeshGeometry());
+	geometry->loadFile(fileName);
+	_geometry = geometry;
 }
 
-
-
-void MeshModel::draw()
+void MeshModel::draw(Renderer* renderer)
 {
-	
-}
\ No newline at end of file
+	renderer->SetMaterial(getMaterial());
+	renderer->DrawTriangles(&_geometry->vertex_positions, &_geometry->vertex_normals);
+}
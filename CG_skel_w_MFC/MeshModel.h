@@ -2,24 +2,39 @@
 #include "scene.h"
 #include "vec.h"
 #include "mat.h"
+#include "MeshGeometry.h"
 #include <string>
 
 using namespace std;
 
+// One placement of a MeshGeometry in the scene. The vertex data is shared
+// with every other instance of the same geometry; an instance only adds its
+// material. Once added to a scene, material and transform are kept in the
+// scene's ModelRegistry.
 class MeshModel : public Model
 {
 protected :
 	MeshModel() {}
-	vec3 *vertex_positions;
-	//add more attributes
-	mat4 _world_transform;
-	mat3 _normal_transform;
+	MeshGeometryPtr _geometry;
+	Material _material;
 
 public:
 
 	MeshModel(string fileName);
+	MeshModel(MeshGeometryPtr geometry);
 	~MeshModel(void);
 	void loadFile(string fileName);
-	void draw();
-	
+	void draw(Renderer* renderer);
+
+	const MeshGeometryPtr& getGeometry() const { return _geometry; }
+	const Material& getMaterial() const
+	{
+		return registry ? registry->material(registry->dense(handle)) : _material;
+	}
+	void setMaterial(const Material& material)
+	{
+		_material = material;
+		if (registry)
+			registry->setMaterial(registry->dense(handle), material);
+	}
 };
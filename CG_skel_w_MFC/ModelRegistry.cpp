@@ -0,0 +1,110 @@
+#include "StdAfx.h"
+#include "ModelRegistry.h"
+
+ModelHandle ModelRegistry::create(Model* facade, int parentNode, const MeshGeometryPtr& geometry, const Material& material)
+{
+	int slot;
+	if (!m_freeSlots.empty())
+	{
+		slot = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	}
+	else
+	{
+		slot = (int)m_slotDense.size();
+		m_slotDense.push_back(-1);
+		m_slotGeneration.push_back(0);
+	}
+
+	int mesh = -1;
+	AABB bounds;
+	if (geometry)
+	{
+		// instances of one geometry share a mesh id
+		map<const MeshGeometry*, int>::iterator it = m_meshIds.find(geometry.get());
+		if (it != m_meshIds.end())
+			mesh = it->second;
+		else if (!m_freeMeshes.empty())
+		{
+			mesh = m_freeMeshes.back();
+			m_freeMeshes.pop_back();
+			m_meshes[mesh] = geometry;
+			m_meshIds[geometry.get()] = mesh;
+		}
+		else
+		{
+			mesh = (int)m_meshes.size();
+			m_meshes.push_back(geometry);
+			m_meshInstances.push_back(0);
+			m_meshIds[geometry.get()] = mesh;
+		}
+		m_meshInstances[mesh]++;
+		bounds = AABB(geometry->bbox_min, geometry->bbox_max);
+	}
+
+	int node = m_transforms.createNode(parentNode);
+	int d = (int)m_slot.size();
+	m_slotDense[slot] = d;
+	m_slot.push_back(slot);
+	m_node.push_back(node);
+	m_mesh.push_back(mesh);
+	m_localBounds.push_back(bounds);
+	m_worldBounds.push_back(bounds);
+	m_material.push_back(material);
+	m_facade.push_back(facade);
+
+	if (node >= (int)m_nodeDense.size())
+		m_nodeDense.resize(node + 1, -1);
+	m_nodeDense[node] = d;
+	return ModelHandle(slot, m_slotGeneration[slot]);
+}
+
+void ModelRegistry::destroy(ModelHandle handle)
+{
+	int d = dense(handle);
+	if (d < 0)
+		return;
+
+	// children move up to the removed model's parent
+	int node = m_node[d];
+	int parent = m_transforms.parent(node);
+	while (m_transforms.firstChild(node) != TransformHierarchy::NO_PARENT)
+		m_transforms.setParent(m_transforms.firstChild(node), parent);
+	m_transforms.destroyNode(node);
+	m_nodeDense[node] = -1;
+
+	// the last instance of a geometry gives up its reference and mesh id
+	int mesh = m_mesh[d];
+	if (mesh >= 0 && --m_meshInstances[mesh] == 0)
+	{
+		m_meshIds.erase(m_meshes[mesh].get());
+		m_meshes[mesh].reset();
+		m_freeMeshes.push_back(mesh);
+	}
+
+	// fill the hole with the last model to keep the arrays dense
+	int last = (int)m_slot.size() - 1;
+	if (d != last)
+	{
+		m_slot[d] = m_slot[last];
+		m_node[d] = m_node[last];
+		m_mesh[d] = m_mesh[last];
+		m_localBounds[d] = m_localBounds[last];
+		m_worldBounds[d] = m_worldBounds[last];
+		m_material[d] = m_material[last];
+		m_facade[d] = m_facade[last];
+		m_slotDense[m_slot[d]] = d;
+		m_nodeDense[m_node[d]] = d;
+	}
+	m_slot.pop_back();
+	m_node.pop_back();
+	m_mesh.pop_back();
+	m_localBounds.pop_back();
+	m_worldBounds.pop_back();
+	m_material.pop_back();
+	m_facade.pop_back();
+
+	m_slotDense[handle.slot] = -1;
+	m_slotGeneration[handle.slot]++;
+	m_freeSlots.push_back(handle.slot);
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include <vector>
+#include <map>
+#include "vec.h"
+#include "mat.h"
+#include "Bounds.h"
+#include "MeshGeometry.h"
+#include "TransformHierarchy.h"
+#include "Renderer.h"
+
+using namespace std;
+
+class Model;
+
+// Stable reference to a registered model. Stays valid while the model lives
+// and is detected as stale (rather than aliasing a newer model) afterwards.
+struct ModelHandle
+{
+	int slot;
+	unsigned generation;
+
+	ModelHandle() : slot(-1), generation(0) {}
+	ModelHandle(int s, unsigned g) : slot(s), generation(g) {}
+	bool operator==(const ModelHandle& h) const { return slot == h.slot && generation == h.generation; }
+	bool operator!=(const ModelHandle& h) const { return !(*this == h); }
+};
+
+// Per-model state stored as parallel dense arrays, so passes over all
+// models stream through contiguous memory instead of chasing Model*.
+// Dense indices change when models are removed (the last one is moved into
+// the hole); handles don't.
+class ModelRegistry
+{
+	// slot table behind the handles
+	vector<int> m_slotDense;	// -1 for free slots
+	vector<unsigned> m_slotGeneration;
+	vector<int> m_freeSlots;
+
+	// dense per-model arrays
+	vector<int> m_slot;
+	vector<int> m_node;
+	vector<int> m_mesh;		// index into m_meshes, -1 if the model draws itself
+	vector<AABB> m_localBounds;
+	vector<AABB> m_worldBounds;
+	vector<Material> m_material;
+	vector<Model*> m_facade;
+
+	vector<int> m_nodeDense;	// transform node -> dense index
+	// shared geometry by mesh id; an id is freed (its entry reset) when its
+	// last instance goes, so unused geometry can leave the asset cache
+	vector<MeshGeometryPtr> m_meshes;
+	vector<int> m_meshInstances;
+	vector<int> m_freeMeshes;
+	map<const MeshGeometry*, int> m_meshIds;
+	TransformHierarchy m_transforms;
+
+public:
+	ModelHandle create(Model* facade, int parentNode, const MeshGeometryPtr& geometry, const Material& material);
+	void destroy(ModelHandle handle);
+
+	bool isValid(ModelHandle h) const
+	{
+		return h.slot >= 0 && h.slot < (int)m_slotDense.size() &&
+			m_slotDense[h.slot] >= 0 && m_slotGeneration[h.slot] == h.generation;
+	}
+	// -1 for stale handles
+	int dense(ModelHandle h) const { return isValid(h) ? m_slotDense[h.slot] : -1; }
+	int denseOfSlot(int slot) const { return m_slotDense[slot]; }
+	int denseOfNode(int node) const { return node < (int)m_nodeDense.size() ? m_nodeDense[node] : -1; }
+	ModelHandle handle(int dense) const { return ModelHandle(m_slot[dense], m_slotGeneration[m_slot[dense]]); }
+	int size() const { return (int)m_slot.size(); }
+
+	// dense array access
+	int slot(int d) const { return m_slot[d]; }
+	int node(int d) const { return m_node[d]; }
+	int mesh(int d) const { return m_mesh[d]; }
+	const AABB& localBounds(int d) const { return m_localBounds[d]; }
+	const AABB& worldBounds(int d) const { return m_worldBounds[d]; }
+	void setWorldBounds(int d, const AABB& b) { m_worldBounds[d] = b; }
+	const Material& material(int d) const { return m_material[d]; }
+	void setMaterial(int d, const Material& m) { m_material[d] = m; }
+	Model* facade(int d) const { return m_facade[d]; }
+
+	// null for freed mesh ids
+	const MeshGeometryPtr& meshGeometry(int mesh) const { return m_meshes[mesh]; }
+	int meshCount() const { return (int)m_meshes.size(); }
+
+	TransformHierarchy& transforms() { return m_transforms; }
+	const TransformHierarchy& transforms() const { return m_transforms; }
+};
@@ -0,0 +1,605 @@
+#pragma once
+#include <cmath>
+#include <algorithm>
+#include "Lighting.h"
+
+using namespace std;
+
+// The software renderer's fill loop. It depends on neither GL nor the
+// renderer's types, so it also builds on its own (see bench/RasterBench.cpp).
+//
+// The pipeline state is a set of template parameters: each combination is a
+// fill loop of its own, with no per pixel tests on the state, and
+// SelectFill() picks one once per draw. FillTriangleGeneric() does the same
+// work testing the state per pixel; it's the reference the specialized loops
+// are checked and measured against.
+//
+// A triangle is set up once (TriangleSetup), however many tiles it is filled
+// in: depth, 1/w and every attribute get a plane equation there, and the fill
+// loops only step them.
+//
+// SHADE_GBUFFER fills don't shade at all: they leave depth and a
+// GBufferTexel per pixel for the renderer to light later, once per visible
+// pixel. SHADE_DEPTH fills only write depth, for a pre-pass that later
+// fills with DEPTH_EQUAL shade over, or for shadow maps; their target's
+// color may be NULL.
+
+enum DepthFormat { DEPTH_FLOAT32, DEPTH_UNORM16 };
+enum ShadeModel { SHADE_FLAT, SHADE_INTERPOLATED, SHADE_LIT, SHADE_GBUFFER, SHADE_DEPTH };
+enum DepthTest { DEPTH_OFF, DEPTH_LESS, DEPTH_EQUAL };
+enum BlendMode { BLEND_NONE, BLEND_ALPHA, BLEND_ADD };
+
+enum { MAX_ATTRIBUTES = 6 };
+
+struct FillState
+{
+	bool depthTest;		// less than, writing depth
+	bool depthEqual;	// with depthTest: equal instead, not writing, to shade over a depth pre-pass
+	DepthFormat depthFormat;
+	// flat: the input color; interpolated: RGB from attributes 0..2; lit:
+	// the normal from attributes 0..2 and world position from 3..5, lit
+	// per pixel by ShadeBatch with the target's lights; G-buffer: the normal
+	// from attributes 0..2, the input color and material into the G-buffer;
+	// depth: nothing but the depth
+	ShadeModel shading;
+	int attributes;		// interpolated per vertex values: 0, 3 or MAX_ATTRIBUTES
+	BlendMode blend;	// alpha: src * alpha + dst * (1 - alpha); add: dst + src * alpha
+
+	FillState() : depthTest(true), depthEqual(false), depthFormat(DEPTH_FLOAT32), shading(SHADE_FLAT), attributes(0), blend(BLEND_NONE) {}
+};
+
+// A pixel of the G-buffer, 8 bytes besides its depth: the normal, mapped
+// onto an octahedron and kept in two snorm16, the albedo in 8 bits a
+// channel and the material lighting the pixel, 0 for a pixel with nothing
+// to light. The position isn't kept, it follows from the depth.
+struct GBufferTexel
+{
+	short normal[2];
+	unsigned char albedo[3];
+	unsigned char material;
+};
+
+inline float SignNotZero(float v) { return v < 0 ? -1.0f : 1.0f; }
+
+// Any length; the octahedron keeps only the direction. No direction at all
+// becomes +z.
+inline void EncodeNormal(float x, float y, float z, short* out)
+{
+	float l1 = fabs(x) + fabs(y) + fabs(z);
+	if (!(l1 > 0))
+	{
+		out[0] = out[1] = 0;
+		return;
+	}
+	float u = x / l1, v = y / l1;
+	// the lower half folds over the diagonals
+	if (z < 0)
+	{
+		float fu = (1 - fabs(v)) * SignNotZero(u), fv = (1 - fabs(u)) * SignNotZero(v);
+		u = fu;
+		v = fv;
+	}
+	out[0] = (short)floor(u * 32767.0f + 0.5f);
+	out[1] = (short)floor(v * 32767.0f + 0.5f);
+}
+
+// Not unit length; ShadeBatch normalizes.
+inline void DecodeNormal(const short* in, float& x, float& y, float& z)
+{
+	x = in[0] * (1 / 32767.0f);
+	y = in[1] * (1 / 32767.0f);
+	z = 1 - fabs(x) - fabs(y);
+	if (z < 0)
+	{
+		float fx = (1 - fabs(y)) * SignNotZero(x), fy = (1 - fabs(x)) * SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+}
+
+inline unsigned char EncodeUnorm8(float v)
+{
+	return v <= 0 ? 0 : v >= 1 ? 255 : (unsigned char)(v * 255.0f + 0.5f);
+}
+
+// Where a fill may write: the clip rectangle [x0,x1) x [y0,y1) of color,
+// depth and G-buffer planes whose rows are stride pixels apart.
+struct FillTarget
+{
+	float* color;		// RGB, unused by SHADE_DEPTH
+	void* depth;		// float or unsigned short, by DepthFormat
+	GBufferTexel* gbuffer;	// for SHADE_GBUFFER
+	int stride;
+	int x0, y0, x1, y1;
+	const ShadingContext* shading;	// for SHADE_LIT
+};
+
+// A triangle in screen space: x, y, depth in [0,1] and 1/w per vertex, the
+// vertices' attributes, the color and alpha used by flat shading and
+// blending, and the material lit pixels have besides that color (or its
+// G-buffer material, for SHADE_GBUFFER).
+struct FillInput
+{
+	const float* v[3];
+	const float* attributes[3];
+	float color[3];
+	float alpha;
+	float specular, shininess;
+	int material;
+};
+
+struct TriangleSetup;
+typedef void (*FillFunction)(const FillTarget& target, const TriangleSetup& triangle);
+
+// Signed doubled area of (a, b, p); positive when p is left of a->b.
+inline float EdgeFunction(const float* a, const float* b, float px, float py)
+{
+	return (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+}
+
+// Top-left fill rule: pixels exactly on a shared edge belong to one triangle.
+// With counter clockwise winding and y up, top edges run towards -x and left
+// edges run towards -y.
+inline bool IsTopLeft(const float* a, const float* b)
+{
+	return (a[1] == b[1] && b[0] < a[0]) || b[1] < a[1];
+}
+
+// Whether the triangle covers the sample at (px, py), by the same rule the
+// fill loops use. area is the triangle's signed doubled area.
+inline bool CoversSample(const float* a, const float* b0, const float* c0, float area, float px, float py)
+{
+	const float* b = area > 0 ? b0 : c0;
+	const float* c = area > 0 ? c0 : b0;
+	float w0 = EdgeFunction(b, c, px, py), w1 = EdgeFunction(c, a, px, py), w2 = EdgeFunction(a, b, px, py);
+	return (w0 > 0 || (w0 == 0 && IsTopLeft(b, c))) &&
+		(w1 > 0 || (w1 == 0 && IsTopLeft(c, a))) &&
+		(w2 > 0 || (w2 == 0 && IsTopLeft(a, b)));
+}
+
+template<DepthFormat FORMAT> struct DepthTraits;
+
+template<> struct DepthTraits<DEPTH_FLOAT32>
+{
+	typedef float Value;
+	static Value encode(float z) { return z; }
+};
+
+template<> struct DepthTraits<DEPTH_UNORM16>
+{
+	typedef unsigned short Value;
+	static Value encode(float z) { return z <= 0 ? 0 : z >= 1 ? 65535 : (Value)(z * 65535.0f + 0.5f); }
+};
+
+// A value over the screen, anchored at the triangle's first vertex:
+// at(x, y) = a + dx * x + dy * y, with x and y measured from that vertex.
+// Evaluating it once per row and stepping by dx per pixel costs one add per
+// pixel.
+struct AttributePlane
+{
+	float a, dx, dy;
+
+	float at(float x, float y) const { return a + dx * x + dy * y; }
+};
+
+// Everything about a triangle the fill loops need that doesn't depend on the
+// tile being filled, computed once: the vertices in counter clockwise
+// order, the edge steps and fill rule, the bounding box and the plane
+// equations. Depth is affine in screen space and gets its own plane;
+// attributes are perspective correct, their planes hold attribute / w
+// and are divided by the plane of 1/w per pixel.
+struct TriangleSetup
+{
+	float v[3][4];
+	float invArea;
+	float dx[3], dy[3];	// edge function steps per pixel
+	bool topLeft[3];
+	int minX, maxX, minY, maxY;	// pixels the bounding box touches
+	AttributePlane depth, invW;
+	AttributePlane attributes[MAX_ATTRIBUTES];	// attribute / w
+	float color[3];
+	float alpha;
+	float specular, shininess;
+	int material;
+
+	// false for a triangle with no area. attributeCount must be what the
+	// fill loop interpolates, and the input must have that many.
+	bool init(const FillInput& input, int attributeCount)
+	{
+		const float* a = input.v[0];
+		float area = EdgeFunction(a, input.v[1], input.v[2][0], input.v[2][1]);
+		if (area == 0)
+			return false;
+		int i1 = area > 0 ? 1 : 2, i2 = area > 0 ? 2 : 1;
+		const float* p[3] = { a, input.v[i1], input.v[i2] };
+		const float* attribute[3] = { input.attributes[0], input.attributes[i1], input.attributes[i2] };
+		for (int k = 0; k < 3; k++)
+			for (int c = 0; c < 4; c++)
+				v[k][c] = p[k][c];
+		invArea = 1.0f / fabs(area);
+
+		dx[0] = v[1][1] - v[2][1];  dx[1] = v[2][1] - v[0][1];  dx[2] = v[0][1] - v[1][1];
+		dy[0] = v[2][0] - v[1][0];  dy[1] = v[0][0] - v[2][0];  dy[2] = v[1][0] - v[0][0];
+		topLeft[0] = IsTopLeft(v[1], v[2]);
+		topLeft[1] = IsTopLeft(v[2], v[0]);
+		topLeft[2] = IsTopLeft(v[0], v[1]);
+		minX = (int)floor(min(v[0][0], min(v[1][0], v[2][0])));
+		maxX = (int)ceil(max(v[0][0], max(v[1][0], v[2][0])));
+		minY = (int)floor(min(v[0][1], min(v[1][1], v[2][1])));
+		maxY = (int)ceil(max(v[0][1], max(v[1][1], v[2][1])));
+
+		plane(depth, v[0][2], v[1][2], v[2][2]);
+		plane(invW, v[0][3], v[1][3], v[2][3]);
+		for (int k = 0; k < attributeCount; k++)
+			plane(attributes[k], attribute[0][k] * v[0][3], attribute[1][k] * v[1][3], attribute[2][k] * v[2][3]);
+		for (int k = 0; k < 3; k++)
+			color[k] = input.color[k];
+		alpha = input.alpha;
+		specular = input.specular;
+		shininess = input.shininess;
+		material = input.material;
+		return true;
+	}
+
+	// The barycentric weight of vertex i steps by dx[i] / area per pixel;
+	// the weights add up to one, so only those of vertices 1 and 2 are needed.
+	void plane(AttributePlane& out, float f0, float f1, float f2) const
+	{
+		out.a = f0;
+		out.dx = ((f1 - f0) * dx[1] + (f2 - f0) * dx[2]) * invArea;
+		out.dy = ((f1 - f0) * dy[1] + (f2 - f0) * dy[2]) * invArea;
+	}
+};
+
+// Where a fill call starts: the triangle's bounding box inside the target,
+// and the edge functions and planes' offsets at its first pixel center.
+struct FillSetup
+{
+	int minX, maxX, minY, maxY;
+	float w[3];
+	float x, y;	// first pixel center, from the triangle's first vertex
+
+	// false if nothing can be drawn
+	bool init(const FillTarget& target, const TriangleSetup& triangle)
+	{
+		minX = max(target.x0, triangle.minX);
+		maxX = min(target.x1 - 1, triangle.maxX);
+		minY = max(target.y0, triangle.minY);
+		maxY = min(target.y1 - 1, triangle.maxY);
+		if (minX > maxX || minY > maxY)
+			return false;
+		const float* a = triangle.v[0];
+		const float* b = triangle.v[1];
+		const float* c = triangle.v[2];
+		float px = minX + 0.5f, py = minY + 0.5f;
+		w[0] = EdgeFunction(b, c, px, py);
+		w[1] = EdgeFunction(c, a, px, py);
+		w[2] = EdgeFunction(a, b, px, py);
+		x = px - a[0];
+		y = py - a[1];
+		return true;
+	}
+};
+
+// bitwise, so the test is one branch rather than six
+inline bool Inside(const TriangleSetup& t, float w0, float w1, float w2)
+{
+	return ((w0 > 0) | ((w0 == 0) & t.topLeft[0])) &
+		((w1 > 0) | ((w1 == 0) & t.topLeft[1])) &
+		((w2 > 0) | ((w2 == 0) & t.topLeft[2]));
+}
+
+template<BlendMode BLEND>
+inline void BlendPixel(float* dst, const float* src, float alpha)
+{
+	for (int k = 0; k < 3; k++)
+	{
+		if (BLEND == BLEND_ALPHA)
+			dst[k] = src[k] * alpha + dst[k] * (1 - alpha);
+		else if (BLEND == BLEND_ADD)
+			dst[k] += src[k] * alpha;
+		else
+			dst[k] = src[k];
+	}
+}
+
+// Pixels of one triangle waiting to be lit, SHADE_BATCH at a time.
+template<BlendMode BLEND>
+struct LitPixels
+{
+	SurfaceBatch batch;
+	float* pixels[SHADE_BATCH];
+	int count;
+	float alpha;
+
+	void init(const TriangleSetup& triangle)
+	{
+		count = 0;
+		alpha = triangle.alpha;
+		for (int j = 0; j < SHADE_BATCH; j++)
+		{
+			batch.px[j] = batch.py[j] = batch.pz[j] = 0;
+			batch.nx[j] = batch.ny[j] = batch.nz[j] = 0;
+			for (int k = 0; k < 3; k++)
+				batch.albedo[k][j] = triangle.color[k];
+			batch.specular[j] = triangle.specular;
+			batch.shininess[j] = triangle.shininess;
+		}
+	}
+
+	// attribute holds the normal and the world position, already divided by 1/w
+	void add(const ShadingContext& shading, float* dst, const float* attribute)
+	{
+		batch.nx[count] = attribute[0];  batch.ny[count] = attribute[1];  batch.nz[count] = attribute[2];
+		batch.px[count] = attribute[3];  batch.py[count] = attribute[4];  batch.pz[count] = attribute[5];
+		pixels[count] = dst;
+		if (++count == SHADE_BATCH)
+			flush(shading);
+	}
+
+	void flush(const ShadingContext& shading)
+	{
+		if (count == 0)
+			return;
+		ShadeBatch(shading, batch);
+		for (int j = 0; j < count; j++)
+		{
+			float src[3] = { batch.color[0][j], batch.color[1][j], batch.color[2][j] };
+			BlendPixel<BLEND>(pixels[j], src, alpha);
+		}
+		count = 0;
+	}
+};
+
+template<DepthTest DEPTH_TEST, DepthFormat FORMAT, ShadeModel SHADING, int ATTRIBUTES, BlendMode BLEND>
+void FillTriangleT(const FillTarget& target, const TriangleSetup& triangle)
+{
+	typedef typename DepthTraits<FORMAT>::Value Depth;
+	enum { ATTRIBUTE_ROOM = ATTRIBUTES > 0 ? ATTRIBUTES : 1 };
+	const bool INTERPOLATED = SHADING == SHADE_INTERPOLATED && ATTRIBUTES >= 3;
+	const bool LIT = SHADING == SHADE_LIT && ATTRIBUTES >= 6;
+	const bool GBUFFER = SHADING == SHADE_GBUFFER && ATTRIBUTES >= 3;
+	FillSetup s;
+	if (!s.init(target, triangle))
+		return;
+	// lit pixels are collected and lit together; pixels of one triangle
+	// never overlap, so their colors can wait
+	LitPixels<BLEND> lit;
+	if (LIT)
+		lit.init(triangle);
+
+	// everything the loop reads goes into locals first: with the counts
+	// known here they fit in registers, and the color stores can't alias them
+	AttributePlane attributePlane[ATTRIBUTE_ROOM];
+	for (int k = 0; k < ATTRIBUTES; k++)
+		attributePlane[k] = triangle.attributes[k];
+	AttributePlane depthPlane = triangle.depth, invWPlane = triangle.invW;
+	float color[3] = { triangle.color[0], triangle.color[1], triangle.color[2] };
+	float alpha = triangle.alpha;
+	float dx0 = triangle.dx[0], dx1 = triangle.dx[1], dx2 = triangle.dx[2];
+	GBufferTexel texel;
+	if (GBUFFER)
+	{
+		for (int k = 0; k < 3; k++)
+			texel.albedo[k] = EncodeUnorm8(color[k]);
+		texel.material = (unsigned char)triangle.material;
+	}
+
+	float w0Row = s.w[0], w1Row = s.w[1], w2Row = s.w[2];
+	for (int y = s.minY; y <= s.maxY; y++)
+	{
+		float w0 = w0Row, w1 = w1Row, w2 = w2Row;
+		// planes restart from their equation every row, so rounding only
+		// builds up along one row
+		float py = s.y + (y - s.minY);
+		float z = depthPlane.at(s.x, py), invW = invWPlane.at(s.x, py);
+		float attribute[ATTRIBUTE_ROOM];
+		for (int k = 0; k < ATTRIBUTES; k++)
+			attribute[k] = attributePlane[k].at(s.x, py);
+		// depth only fills may have no color plane, shadow maps don't
+		float* row = SHADING == SHADE_DEPTH ? NULL : target.color + 3 * (s.minX + y * target.stride);
+		Depth* depth = (Depth*)target.depth + s.minX + y * target.stride;
+		GBufferTexel* gbuffer = GBUFFER ? target.gbuffer + s.minX + y * target.stride : NULL;
+		for (int x = s.minX; x <= s.maxX; x++, depth++)
+		{
+			if (Inside(triangle, w0, w1, w2))
+			{
+				bool pass = true;
+				if (DEPTH_TEST == DEPTH_EQUAL)
+					pass = DepthTraits<FORMAT>::encode(z) == *depth;
+				else if (DEPTH_TEST == DEPTH_LESS)
+				{
+					Depth d = DepthTraits<FORMAT>::encode(z);
+					pass = d < *depth;
+					if (pass)
+						*depth = d;
+				}
+				// depth only fills are done with the depth
+				if (SHADING == SHADE_DEPTH)
+					pass = false;
+				if (pass && GBUFFER)
+				{
+					// attribute / w points the normal's way, w needn't be divided out
+					EncodeNormal(attribute[0], attribute[1], attribute[2], texel.normal);
+					gbuffer[x - s.minX] = texel;
+				}
+				else if (pass && LIT)
+				{
+					float w = 1 / invW, surface[ATTRIBUTE_ROOM];
+					for (int k = 0; k < ATTRIBUTES; k++)
+						surface[k] = attribute[k] * w;
+					lit.add(*target.shading, row + 3 * (x - s.minX), surface);
+				}
+				else if (pass)
+				{
+					float src[3];
+					if (INTERPOLATED)
+					{
+						float w = 1 / invW;
+						for (int k = 0; k < 3; k++)
+							src[k] = attribute[k] * w;
+					}
+					else
+						for (int k = 0; k < 3; k++)
+							src[k] = color[k];
+					BlendPixel<BLEND>(row + 3 * (x - s.minX), src, alpha);
+				}
+			}
+			w0 += dx0;  w1 += dx1;  w2 += dx2;
+			z += depthPlane.dx;
+			invW += invWPlane.dx;
+			for (int k = 0; k < ATTRIBUTES; k++)
+				attribute[k] += attributePlane[k].dx;
+		}
+		w0Row += triangle.dy[0];  w1Row += triangle.dy[1];  w2Row += triangle.dy[2];
+	}
+	if (LIT)
+		lit.flush(*target.shading);
+}
+
+// The same as the specialized loops, deciding everything per pixel. Lit
+// pixels are lit one at a time, each a batch of its own.
+inline void FillTriangleGeneric(const FillState& state, const FillTarget& target, const TriangleSetup& triangle)
+{
+	FillSetup s;
+	if (!s.init(target, triangle))
+		return;
+
+	float w0Row = s.w[0], w1Row = s.w[1], w2Row = s.w[2];
+	for (int y = s.minY; y <= s.maxY; y++)
+	{
+		float w0 = w0Row, w1 = w1Row, w2 = w2Row;
+		float py = s.y + (y - s.minY);
+		float z = triangle.depth.at(s.x, py), invW = triangle.invW.at(s.x, py);
+		float attribute[MAX_ATTRIBUTES];
+		for (int k = 0; k < state.attributes; k++)
+			attribute[k] = triangle.attributes[k].at(s.x, py);
+		for (int x = s.minX; x <= s.maxX; x++)
+		{
+			if (Inside(triangle, w0, w1, w2))
+			{
+				bool pass = true;
+				if (state.depthTest)
+				{
+					int i = x + y * target.stride;
+					if (state.depthFormat == DEPTH_FLOAT32)
+					{
+						float* depth = (float*)target.depth + i;
+						pass = state.depthEqual ? z == *depth : z < *depth;
+						if (pass && !state.depthEqual)
+							*depth = z;
+					}
+					else
+					{
+						unsigned short* depth = (unsigned short*)target.depth + i;
+						unsigned short z16 = DepthTraits<DEPTH_UNORM16>::encode(z);
+						pass = state.depthEqual ? z16 == *depth : z16 < *depth;
+						if (pass && !state.depthEqual)
+							*depth = z16;
+					}
+				}
+				if (state.shading == SHADE_DEPTH)
+					pass = false;
+				if (pass && state.shading == SHADE_GBUFFER && state.attributes >= 3)
+				{
+					GBufferTexel& texel = target.gbuffer[x + y * target.stride];
+					EncodeNormal(attribute[0], attribute[1], attribute[2], texel.normal);
+					for (int k = 0; k < 3; k++)
+						texel.albedo[k] = EncodeUnorm8(triangle.color[k]);
+					texel.material = (unsigned char)triangle.material;
+				}
+				else if (pass)
+				{
+					float src[3];
+					bool interpolated = state.shading == SHADE_INTERPOLATED && state.attributes >= 3;
+					float w = 1 / invW;
+					for (int k = 0; k < 3; k++)
+						src[k] = interpolated ? attribute[k] * w : triangle.color[k];
+					if (state.shading == SHADE_LIT && state.attributes >= 6)
+					{
+						SurfaceBatch batch;
+						for (int j = 0; j < SHADE_BATCH; j++)
+						{
+							batch.nx[j] = attribute[0] * w;  batch.ny[j] = attribute[1] * w;  batch.nz[j] = attribute[2] * w;
+							batch.px[j] = attribute[3] * w;  batch.py[j] = attribute[4] * w;  batch.pz[j] = attribute[5] * w;
+							for (int k = 0; k < 3; k++)
+								batch.albedo[k][j] = triangle.color[k];
+							batch.specular[j] = triangle.specular;
+							batch.shininess[j] = triangle.shininess;
+						}
+						ShadeBatch(*target.shading, batch);
+						for (int k = 0; k < 3; k++)
+							src[k] = batch.color[k][0];
+					}
+					float* dst = target.color + 3 * (x + y * target.stride);
+					switch (state.blend)
+					{
+					case BLEND_ALPHA: BlendPixel<BLEND_ALPHA>(dst, src, triangle.alpha); break;
+					case BLEND_ADD: BlendPixel<BLEND_ADD>(dst, src, triangle.alpha); break;
+					default: BlendPixel<BLEND_NONE>(dst, src, triangle.alpha); break;
+					}
+				}
+			}
+			w0 += triangle.dx[0];  w1 += triangle.dx[1];  w2 += triangle.dx[2];
+			z += triangle.depth.dx;
+			invW += triangle.invW.dx;
+			for (int k = 0; k < state.attributes; k++)
+				attribute[k] += triangle.attributes[k].dx;
+		}
+		w0Row += triangle.dy[0];  w1Row += triangle.dy[1];  w2Row += triangle.dy[2];
+	}
+}
+
+template<DepthTest DEPTH_TEST, DepthFormat FORMAT, ShadeModel SHADING, int ATTRIBUTES>
+inline FillFunction SelectFillBlend(const FillState& state)
+{
+	switch (state.blend)
+	{
+	case BLEND_ALPHA: return FillTriangleT<DEPTH_TEST, FORMAT, SHADING, ATTRIBUTES, BLEND_ALPHA>;
+	case BLEND_ADD: return FillTriangleT<DEPTH_TEST, FORMAT, SHADING, ATTRIBUTES, BLEND_ADD>;
+	default: return FillTriangleT<DEPTH_TEST, FORMAT, SHADING, ATTRIBUTES, BLEND_NONE>;
+	}
+}
+
+template<DepthTest DEPTH_TEST, DepthFormat FORMAT, ShadeModel SHADING>
+inline FillFunction SelectFillAttributes(const FillState& state)
+{
+	if (state.attributes > 3)
+		return SelectFillBlend<DEPTH_TEST, FORMAT, SHADING, MAX_ATTRIBUTES>(state);
+	if (state.attributes > 0)
+		return SelectFillBlend<DEPTH_TEST, FORMAT, SHADING, 3>(state);
+	return SelectFillBlend<DEPTH_TEST, FORMAT, SHADING, 0>(state);
+}
+
+template<DepthTest DEPTH_TEST, DepthFormat FORMAT>
+inline FillFunction SelectFillShading(const FillState& state)
+{
+	if (state.shading == SHADE_DEPTH)
+		return FillTriangleT<DEPTH_TEST, FORMAT, SHADE_DEPTH, 0, BLEND_NONE>;
+	if (state.shading == SHADE_GBUFFER)
+		return FillTriangleT<DEPTH_TEST, FORMAT, SHADE_GBUFFER, 3, BLEND_NONE>;
+	if (state.shading == SHADE_LIT)
+		return SelectFillBlend<DEPTH_TEST, FORMAT, SHADE_LIT, MAX_ATTRIBUTES>(state);
+	if (state.shading == SHADE_INTERPOLATED)
+		return SelectFillAttributes<DEPTH_TEST, FORMAT, SHADE_INTERPOLATED>(state);
+	return SelectFillAttributes<DEPTH_TEST, FORMAT, SHADE_FLAT>(state);
+}
+
+// The fill loop specialized for state. Attribute counts are 0, 3 or
+// MAX_ATTRIBUTES; others are rounded up, and the input must have that many.
+// Lit shading always takes MAX_ATTRIBUTES, G-buffer fills 3 and don't blend,
+// depth only fills take none.
+inline FillFunction SelectFill(const FillState& state)
+{
+	if (!state.depthTest)
+		return SelectFillShading<DEPTH_OFF, DEPTH_FLOAT32>(state);
+	if (state.depthEqual)
+	{
+		if (state.depthFormat == DEPTH_UNORM16)
+			return SelectFillShading<DEPTH_EQUAL, DEPTH_UNORM16>(state);
+		return SelectFillShading<DEPTH_EQUAL, DEPTH_FLOAT32>(state);
+	}
+	if (state.depthFormat == DEPTH_UNORM16)
+		return SelectFillShading<DEPTH_LESS, DEPTH_UNORM16>(state);
+	return SelectFillShading<DEPTH_LESS, DEPTH_FLOAT32>(state);
+}
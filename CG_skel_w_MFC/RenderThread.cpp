@@ -0,0 +1,83 @@
+#include "StdAfx.h"
+#include "RenderThread.h"
+
+using namespace std;
+
+RenderThread::RenderThread(Scene* scene, Renderer* renderer, int width, int height) :
+	m_scene(scene), m_renderer(renderer), m_width(width), m_height(height), m_resolutionScale(1.0f), m_frameBudget(0),
+	m_quit(false), m_demo(false), m_drawing(false), m_framesDrawn(0)
+{
+	m_thread = thread(threadMain, this);
+}
+
+RenderThread::~RenderThread()
+{
+	{
+		lock_guard<mutex> lock(m_lock);
+		m_quit = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void RenderThread::publish(bool fullResolution)
+{
+	SceneSnapshot& snapshot = m_snapshots.back();
+	m_scene->snapshot(snapshot, m_width, m_height);
+	snapshot.resolutionScale = fullResolution ? 1.0f : m_resolutionScale;
+	snapshot.frameBudget = fullResolution ? 0.0f : m_frameBudget;
+	m_snapshots.publish();
+	{
+		// pairs with the check in threadMain, so the wake up can't be missed
+		lock_guard<mutex> lock(m_lock);
+	}
+	m_wake.notify_one();
+}
+
+void RenderThread::showDemo()
+{
+	m_demo = true;
+	{
+		lock_guard<mutex> lock(m_lock);
+	}
+	m_wake.notify_one();
+}
+
+void RenderThread::threadMain(RenderThread* self)
+{
+	for (;;)
+	{
+		{
+			unique_lock<mutex> lock(self->m_lock);
+			while (!self->m_snapshots.hasFresh() && !self->m_demo && !self->m_quit)
+				self->m_wake.wait(lock);
+			if (self->m_quit)
+				return;
+			// before consuming, so isBusy() never sees a gap
+			self->m_drawing = true;
+		}
+		self->m_snapshots.consume();
+		self->drawSnapshot(self->m_snapshots.front());
+	}
+}
+
+void RenderThread::drawSnapshot(const SceneSnapshot& snapshot)
+{
+	Renderer& renderer = *m_renderer;
+	if (snapshot.width > 0 && (snapshot.width != renderer.GetOutputWidth() || snapshot.height != renderer.GetOutputHeight()))
+		renderer.Resize(snapshot.width, snapshot.height);
+	if (snapshot.resolutionScale != renderer.GetResolutionScale())
+		renderer.SetResolutionScale(snapshot.resolutionScale);
+	renderer.SetFrameBudget(snapshot.frameBudget);
+	renderer.ClearColorBuffer();
+	renderer.ClearDepthBuffer();
+	m_sceneRenderer.render(snapshot, renderer);
+	if (m_demo.exchange(false))
+	{
+		renderer.Flush();
+		renderer.SetDemoBuffer();
+	}
+	renderer.PublishFrame();
+	m_framesDrawn++;
+	m_drawing = false;
+}
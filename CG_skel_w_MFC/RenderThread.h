@@ -0,0 +1,72 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "Scene.h"
+#include "SceneRenderer.h"
+#include "TripleBuffer.h"
+
+using namespace std;
+
+// Draws the scene on a thread of its own, so input handling never waits for
+// a frame.
+//
+// The GL thread calls publish() after changing the scene: that copies the
+// scene into a snapshot and hands it over through a lock-free triple buffer.
+// The render thread draws the newest snapshot whenever there is one, and
+// hands the finished frame back the same way (Renderer::PublishFrame); the
+// GL thread uploads it with Renderer::ShowLatestFrame(). Snapshots that
+// arrive while a frame is being drawn are coalesced into the next one.
+class RenderThread
+{
+	Scene* m_scene;
+	Renderer* m_renderer;
+	SceneRenderer m_sceneRenderer;
+	TripleBuffer<SceneSnapshot> m_snapshots;
+	int m_width, m_height;
+	float m_resolutionScale;
+	float m_frameBudget;
+
+	// the render thread sleeps here between snapshots
+	mutex m_lock;
+	condition_variable m_wake;
+	bool m_quit;
+	atomic<bool> m_demo;
+	atomic<bool> m_drawing;
+	atomic<int> m_framesDrawn;
+	thread m_thread;
+
+	static void threadMain(RenderThread* self);
+	void drawSnapshot(const SceneSnapshot& snapshot);
+
+	RenderThread(const RenderThread&);
+	RenderThread& operator=(const RenderThread&);
+
+public:
+	// From now on only the render thread may draw with renderer, and
+	// only the calling thread may touch scene.
+	RenderThread(Scene* scene, Renderer* renderer, int width, int height);
+	~RenderThread();
+
+	// Size of the frames to draw, e.g. from the window's reshape.
+	void setFrameSize(int width, int height) { m_width = width; m_height = height; }
+	// Fraction of the frame size to draw at, from the next publish() on.
+	void setResolutionScale(float scale) { m_resolutionScale = scale; }
+	float getResolutionScale() const { return m_resolutionScale; }
+	// Frame time to hold by scaling the resolution further, 0 for none.
+	void setFrameBudget(float milliseconds) { m_frameBudget = milliseconds; }
+
+	// Snapshots the scene as it is now and wakes the render thread. A full
+	// resolution frame ignores the resolution scale and the frame budget.
+	void publish(bool fullResolution = false);
+
+	// Draws the demo pattern over the next frame.
+	void showDemo();
+
+	// True from publish() until the frame drawn from it was handed back, so
+	// the GL thread knows whether to keep watching for new frames.
+	bool isBusy() const { return m_drawing.load() || m_snapshots.hasFresh() || m_demo.load(); }
+
+	int getFramesDrawn() const { return m_framesDrawn.load(); }
+};
@@ -3,17 +3,21 @@
 #include "CG_skel_w_MFC.h"
 #include "InitShader.h"
 #include "GL\freeglut.h"
+#include "matexpr.h"
+#include "AllocationCounter.h"
+#include <algorithm>
+#include <cstring>
 
 #define INDEX(width,x,y,c) (x+y*width)*3+c
 
-Renderer::Renderer() :m_width(512), m_height(512)
+Renderer::Renderer() :m_width(512), m_height(512), m_resolutionScale(1.0f), m_lastFrameTime(0), m_allocationsAtFrameEnd(0), m_lastFrameAllocations(0), m_texWidth(0), m_texHeight(0), m_shownWidth(0), m_shownHeight(0), m_glReady(false)
 {
-	InitOpenGLRendering();
+	Init();
 	CreateBuffers(512,512);
 }
-Renderer::Renderer(int width, int height) :m_width(width), m_height(height)
+Renderer::Renderer(int width, int height) :m_width(width), m_height(height), m_resolutionScale(1.0f), m_lastFrameTime(0), m_allocationsAtFrameEnd(0), m_lastFrameAllocations(0), m_texWidth(0), m_texHeight(0), m_shownWidth(0), m_shownHeight(0), m_glReady(false)
 {
-	InitOpenGLRendering();
+	Init();
 	CreateBuffers(width,height);
 }
 
@@ -21,28 +25,1099 @@ Renderer::~Renderer(void)
 {
 }
 
+void Renderer::Init()
+{
+	// every thread that can record draws gets its own list and arena
+	int slots = JobSystem::instance().getSlotCount();
+	m_commands.resize(slots);
+	m_frameMemory.setThreadCount(slots);
+	m_slotLights.resize(slots);
+	m_cullFace = CULL_BACK;
+	m_frontFace = WINDING_CCW;
+	m_shading = SHADING_NONE;
+	m_renderPath = PATH_FORWARD;
+	m_reflection = REFLECT_BLINN_PHONG;
+	m_ambient = vec3(0, 0, 0);
+	m_depthTest = true;
+	m_depthFormat = DEPTH_FLOAT32;
+	m_blendMode = BLEND_NONE;
+	m_screen = NULL;
+	m_outcodes = NULL;
+	m_attributes = NULL;
+	m_vertexCount = 0;
+	m_attributeCount = 0;
+	m_deferredCommands = 0;
+	m_prepassCommands = 0;
+	m_tilesX = m_tilesY = 0;
+	m_binChunks = 0;
+	m_shadowPass = false;
+}
+
 
 
 void Renderer::CreateBuffers(int width, int height)
 {
-	m_width=width;
-	m_height=height;	
-	CreateOpenGLBuffer(); //Do not remove this line.
-	m_outBuffer = new float[3*m_width*m_height];
+	FrameBuffer& target=m_frames.back();
+	m_outputWidth=width;
+	m_outputHeight=height;
+	float scale=m_resolutionScale*m_dynamicResolution.getScale();
+	int scaledWidth=(int)(width*scale+0.5f);
+	int scaledHeight=(int)(height*scale+0.5f);
+	target.resize(scaledWidth,scaledHeight,width,height);
+	m_width=target.getWidth();
+	m_height=target.getHeight();
+	m_stride=target.getStride();
+	m_outBuffer=target.color();
+	target.setDepthFormat(m_depthFormat);
+	m_zbuffer=target.depthData();
+	m_view.viewport=Viewport(0,0,m_width,m_height);
+}
+
+int Renderer::GetBufferAllocationCount() const
+{
+	int count=0;
+	for (int i=0; i<3; i++)
+		count+=m_frames.buffer(i).getAllocationCount();
+	return count;
+}
+
+void Renderer::Resize(int width, int height)
+{
+	CreateBuffers(width,height);
+}
+
+void Renderer::SetResolutionScale(float scale)
+{
+	Flush();
+	m_resolutionScale=scale;
+	CreateBuffers(m_outputWidth,m_outputHeight);
+}
+
+void Renderer::SetDepthFormat(DepthFormat format)
+{
+	if (format == m_depthFormat)
+		return;
+	Flush();
+	m_depthFormat = format;
+	CreateBuffers(m_outputWidth,m_outputHeight);
+}
+
+void Renderer::SetFrameBudget(float milliseconds)
+{
+	float scale=m_dynamicResolution.getScale();
+	m_dynamicResolution.setBudget(milliseconds);
+	if (m_dynamicResolution.getScale()!=scale)
+	{
+		Flush();
+		CreateBuffers(m_outputWidth,m_outputHeight);
+	}
+}
+
+void Renderer::ClearColorBuffer()
+{
+	Flush();
+	m_frameStart=chrono::steady_clock::now();
+	m_frames.back().clearColor(0.0f);
+}
+
+void Renderer::ClearDepthBuffer()
+{
+	Flush();
+	m_frames.back().clearDepth(1.0f);
+}
+
+void Renderer::SetCameraTransform(const mat4& cTransform)
+{
+	m_cTransform=cTransform;
+	m_view.viewProjection=m_projection*m_cTransform;
+	m_view.eye=EyePosition(cTransform);
+}
+
+void Renderer::SetProjection(const mat4& projection)
+{
+	m_projection=projection;
+	m_view.viewProjection=m_projection*m_cTransform;
+}
+
+void Renderer::SetCamera(const mat4& cTransform, const mat4& projection, const mat4& viewProjection)
+{
+	m_cTransform=cTransform;
+	m_projection=projection;
+	m_view.viewProjection=viewProjection;
+	m_view.eye=EyePosition(cTransform);
+}
+
+void Renderer::SetViewport(const Viewport& viewport)
+{
+	m_view.viewport=viewport;
+}
+
+void Renderer::SetObjectMatrices(const mat4& oTransform, const mat3& nTransform)
+{
+	m_oTransform=oTransform;
+	m_nTransform=nTransform;
+}
+
+void Renderer::SetMaterial(const Material& material)
+{
+	m_material=material;
+}
+
+void Renderer::SetLights(const ShadingLight* lights, int count, const vec3& ambient,
+	const ShadowMap* shadows, int shadowCount)
+{
+	// draws recorded so far keep the lights they were drawn with
+	Flush();
+	m_lights.assign(lights, lights + count);
+	m_shadows.assign(shadows, shadows + shadowCount);
+	m_ambient=ambient;
+}
+
+void Renderer::BeginShadowMap(float* depth, int size)
+{
+	// the frame's draws so far are done with the frame's planes
+	Flush();
+	m_shadowPass = true;
+	m_frameOutBuffer = m_outBuffer;
+	m_frameZBuffer = m_zbuffer;
+	m_frameWidth = m_width;
+	m_frameHeight = m_height;
+	m_frameStride = m_stride;
+	fill(depth, depth + size * size, 1.0f);
+	m_outBuffer = NULL;
+	m_zbuffer = depth;
+	m_width = m_height = m_stride = size;
+}
+
+void Renderer::EndShadowMap()
+{
+	Flush();
+	m_shadowPass = false;
+	m_outBuffer = m_frameOutBuffer;
+	m_zbuffer = m_frameZBuffer;
+	m_width = m_frameWidth;
+	m_height = m_frameHeight;
+	m_stride = m_frameStride;
+}
+
+void Renderer::SetReflectionModel(ReflectionModel model)
+{
+	Flush();
+	m_reflection=model;
+}
+
+void Renderer::DrawTriangles(const vector<vec3>* vertices, const vector<vec3>* normals)
+{
+	mat4 mvp = lazy(m_view.viewProjection) * m_oTransform;
+	RecordMesh(m_view, vertices, normals, m_oTransform, mvp, m_material);
+}
+
+void Renderer::DrawTrianglesInstanced(const vector<vec3>* vertices, const vector<vec3>* normals,
+	const mat4* oTransforms, const Material* materials, int count)
+{
+	DrawTrianglesInstanced(m_view, vertices, normals, oTransforms, materials, count);
+}
+
+void Renderer::DrawTrianglesInstanced(const RenderView& view, const vector<vec3>* vertices, const vector<vec3>* normals,
+	const mat4* oTransforms, const Material* materials, int count)
+{
+	// the camera part of the chain is shared by every instance
+	for (int i = 0; i < count; i++)
+	{
+		mat4 mvp = lazy(view.viewProjection) * oTransforms[i];
+		RecordMesh(view, vertices, normals, oTransforms[i], mvp, materials[i]);
+	}
+}
+
+void Renderer::RecordMesh(const RenderView& view, const vector<vec3>* vertices, const vector<vec3>* normals,
+	const mat4& model, const mat4& mvp, const Material& material)
+{
+	if (vertices->size() < 3)
+		return;
+	DrawCommand command;
+	command.view = view;
+	command.viewIndex = 0;
+	command.mvp = mvp;
+	command.model = model;
+	command.vertices = vertices;
+	command.normals = normals != NULL && normals->size() >= vertices->size() ? normals : NULL;
+	// lit draws interpolate the vertices' colors (Gouraud) or their normals
+	// and positions (Phong); deferred ones only their normals, the G-buffer
+	// gives back positions from depth, so draws without the depth test
+	// are shaded forward
+	command.deferred = !m_shadowPass && m_renderPath == PATH_DEFERRED && m_shading == SHADING_PHONG &&
+		m_blendMode == BLEND_NONE && m_depthTest;
+	if (command.deferred)
+		command.attributes = 3;
+	else if (m_shadowPass)
+		command.attributes = 0;
+	else
+		command.attributes = m_shading == SHADING_GOURAUD ? 3 : m_shading == SHADING_PHONG ? MAX_ATTRIBUTES : 0;
+	if (command.attributes > 0)
+		command.normalMatrix = NormalMatrix(model);
+	command.color = material.color;
+	command.alpha = material.alpha;
+	command.specular = material.specular;
+	command.shininess = material.shininess;
+	// back faces of counter clockwise triangles have negative area; both
+	// faces of a caster shadow
+	if (m_cullFace == CULL_NONE || m_shadowPass)
+		command.cullSign = 0;
+	else
+		command.cullSign = (m_cullFace == CULL_BACK) == (m_frontFace == WINDING_CCW) ? -1.0f : 1.0f;
+	// the fill loop for this draw's state, chosen once here
+	FillState state;
+	state.depthTest = m_depthTest;
+	state.depthFormat = m_depthFormat;
+	state.blend = m_blendMode;
+	if (command.deferred)
+		state.shading = SHADE_GBUFFER;
+	else
+		state.shading = m_shading == SHADING_GOURAUD ? SHADE_INTERPOLATED : m_shading == SHADING_PHONG ? SHADE_LIT : SHADE_FLAT;
+	state.attributes = command.attributes;
+	if (m_shadowPass)
+	{
+		state.depthTest = true;
+		state.depthFormat = DEPTH_FLOAT32;
+		state.shading = SHADE_DEPTH;
+		state.blend = BLEND_NONE;
+	}
+	// a depth pre-pass: the cheapest fill there is, then the lit one where
+	// the depth came out equal
+	command.depthFill = NULL;
+	if (m_renderPath == PATH_DEPTH_PREPASS && m_shading == SHADING_PHONG && m_blendMode == BLEND_NONE && m_depthTest &&
+		!m_shadowPass)
+	{
+		FillState depthState = state;
+		depthState.shading = SHADE_DEPTH;
+		depthState.attributes = 0;
+		command.depthFill = SelectFill(depthState);
+		state.depthEqual = true;
+	}
+	command.state = state;
+	command.fill = SelectFill(state);
+	command.material = 0;
+	command.firstVertex = 0;
+	command.firstAttribute = 0;
+	m_commands[JobSystem::instance().currentSlot()].push_back(command);
+}
+
+void Renderer::Flush()
+{
+	m_frameCommands.clear();
+	for (size_t i = 0; i < m_commands.size(); i++)
+	{
+		m_frameCommands.insert(m_frameCommands.end(), m_commands[i].begin(), m_commands[i].end());
+		m_commands[i].clear();
+	}
+	if (m_frameCommands.empty())
+		return;
+
+	m_vertexCount = 0;
+	m_attributeCount = 0;
+	m_frameViews.clear();
+	m_gbufferMaterials.clear();
+	m_deferredCommands = 0;
+	m_prepassCommands = 0;
+	bool litPixels = false;
+	for (size_t i = 0; i < m_frameCommands.size(); i++)
+	{
+		DrawCommand& command = m_frameCommands[i];
+		size_t size = command.vertices->size();
+		command.firstVertex = m_vertexCount;
+		command.firstAttribute = m_attributeCount;
+		command.viewIndex = FindView(command.view);
+		if (command.deferred)
+		{
+			command.material = FindMaterial(command);
+			// out of material IDs: lit forward instead
+			if (command.material == 0)
+			{
+				command.deferred = false;
+				command.attributes = command.state.attributes = MAX_ATTRIBUTES;
+				command.state.shading = SHADE_LIT;
+				command.fill = SelectFill(command.state);
+			}
+		}
+		m_deferredCommands += command.deferred ? 1 : 0;
+		m_prepassCommands += command.depthFill != NULL ? 1 : 0;
+		litPixels = litPixels || (command.attributes == MAX_ATTRIBUTES && command.depthFill == NULL);
+		m_vertexCount += (int)(size - size % 3);
+		m_attributeCount += (int)(size - size % 3) * command.attributes;
+	}
+	int triangles = m_vertexCount / 3;
+	JobSystem& jobs = JobSystem::instance();
+	FrameArena& arena = m_frameMemory.arena(jobs.currentSlot());
+	m_screen = arena.allocate<vec4>(m_vertexCount);
+	m_outcodes = arena.allocate<unsigned short>(m_vertexCount);
+	m_attributes = m_attributeCount > 0 ? arena.allocate<float>(m_attributeCount) : NULL;
+
+	m_tilesX = (m_width + TILE_SIZE - 1) / TILE_SIZE;
+	m_tilesY = (m_height + TILE_SIZE - 1) / TILE_SIZE;
+	int tiles = m_tilesX * m_tilesY;
+	// binned in fixed triangle ranges, not per worker, so every tile sees
+	// its triangles in submission order whoever binned them
+	m_binChunks = (min)((int)MAX_BIN_CHUNKS, (max)(1, triangles / 2048));
+	if ((int)m_bins.size() < m_binChunks * tiles)
+		m_bins.resize(m_binChunks * tiles);
+	if ((int)m_binned.size() < m_binChunks)
+		m_binned.resize(m_binChunks);
+	if ((int)m_tileLights.size() < (int)m_frameViews.size() * tiles)
+		m_tileLights.resize(m_frameViews.size() * tiles);
+	if (m_prepassCommands > 0 && (int)m_prepassLights.size() < (int)m_frameViews.size() * tiles)
+		m_prepassLights.resize(m_frameViews.size() * tiles);
+	if (m_deferredCommands > 0)
+	{
+		size_t texels = (size_t)m_stride * m_frames.back().getAllocatedHeight();
+		if (m_gbuffer.size() < texels)
+			m_gbuffer.resize(texels);
+		m_inverseViews.resize(m_frameViews.size());
+		for (size_t v = 0; v < m_frameViews.size(); v++)
+			m_inverseViews[v] = Inverse(m_frameViews[v].viewProjection);
+	}
+
+	JobCounter transformed, binned, rasterized;
+	jobs.parallelFor(TransformJob, this, m_vertexCount, 4096, transformed);
+	jobs.parallelFor(BinJob, this, m_binChunks, 1, binned, &transformed);
+	// the tiles' light lists only need the views, they are made while the
+	// vertices are transformed and rasterizing waits for them with the bins
+	if (litPixels && !m_lights.empty())
+		jobs.parallelFor(LightCullJob, this, tiles, 1, binned);
+	jobs.parallelFor(RasterJob, this, tiles, 1, rasterized, &binned);
+	jobs.wait(rasterized);
+	// the frame's statistics are of what the camera saw
+	if (!m_shadowPass)
+		for (int chunk = 0; chunk < m_binChunks; chunk++)
+			m_frameStats.add(m_chunkStats[chunk]);
+}
+
+// Index of the view in m_frameViews, added if it isn't there yet. Frames
+// have a few views at most.
+int Renderer::FindView(const RenderView& view)
+{
+	for (size_t i = 0; i < m_frameViews.size(); i++)
+	{
+		const RenderView& v = m_frameViews[i];
+		if (v.viewport.x == view.viewport.x && v.viewport.y == view.viewport.y &&
+			v.viewport.width == view.viewport.width && v.viewport.height == view.viewport.height &&
+			memcmp(&v.viewProjection, &view.viewProjection, sizeof(mat4)) == 0)
+			return (int)i;
+	}
+	m_frameViews.push_back(view);
+	return (int)m_frameViews.size() - 1;
+}
+
+// G-buffer material ID for a deferred command, added if it isn't there yet;
+// 0 when the IDs have run out.
+int Renderer::FindMaterial(const DrawCommand& command)
+{
+	for (size_t i = 0; i < m_gbufferMaterials.size(); i++)
+	{
+		const GBufferMaterial& m = m_gbufferMaterials[i];
+		if (m.specular == command.specular && m.shininess == command.shininess && m.view == command.viewIndex)
+			return (int)i + 1;
+	}
+	if (m_gbufferMaterials.size() >= 255)
+		return 0;
+	GBufferMaterial material;
+	material.specular = command.specular;
+	material.shininess = command.shininess;
+	material.view = command.viewIndex;
+	m_gbufferMaterials.push_back(material);
+	return (int)m_gbufferMaterials.size();
+}
+
+int Renderer::FindCommand(int vertex) const
+{
+	int lo = 0, hi = (int)m_frameCommands.size() - 1;
+	while (lo < hi)
+	{
+		int mid = (lo + hi + 1) / 2;
+		if (m_frameCommands[mid].firstVertex <= vertex)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return lo;
+}
+
+// Outcode bits of a clip space vertex. The first six are the view frustum,
+// a triangle with all three vertices out on the same side is rejected. The
+// rest make a triangle go through the clipper: the near and far planes, so
+// depth stays in [0,1] and nothing is projected from behind the eye, and
+// the guard band, GUARD_BAND pixels past each edge of the viewport. Inside
+// the guard band screen coordinates stay small enough for the edge
+// functions, and the tile scissor takes care of the rest.
+enum
+{
+	OUT_LEFT = 1, OUT_RIGHT = 2, OUT_BOTTOM = 4, OUT_TOP = 8, OUT_NEAR = 16, OUT_FAR = 32,
+	OUT_GUARD_LEFT = 64, OUT_GUARD_RIGHT = 128, OUT_GUARD_BOTTOM = 256, OUT_GUARD_TOP = 512,
+	OUT_FRUSTUM = 63,
+	OUT_CLIP = OUT_NEAR | OUT_FAR | OUT_GUARD_LEFT | OUT_GUARD_RIGHT | OUT_GUARD_BOTTOM | OUT_GUARD_TOP
+};
+#define GUARD_BAND 2048
+// a triangle clipped by all six clip planes has at most nine corners
+#define MAX_CLIP_VERTICES 9
+#define MAX_CLIP_TRIANGLES (MAX_CLIP_VERTICES - 2)
+
+static inline vec4 ToClip(const float* m, const vec3& p)
+{
+	return vec4(m[0]*p.x + m[1]*p.y + m[2]*p.z + m[3],
+		m[4]*p.x + m[5]*p.y + m[6]*p.z + m[7],
+		m[8]*p.x + m[9]*p.y + m[10]*p.z + m[11],
+		m[12]*p.x + m[13]*p.y + m[14]*p.z + m[15]);
+}
+
+// Guard band half extents in NDC for a viewport.
+static inline float GuardX(const Viewport& vp) { return 1 + 2.0f * GUARD_BAND / (max)(vp.width, 1); }
+static inline float GuardY(const Viewport& vp) { return 1 + 2.0f * GUARD_BAND / (max)(vp.height, 1); }
+
+static inline unsigned short Outcode(const vec4& p, float guardX, float guardY)
+{
+	unsigned short code = 0;
+	if (p.x < -p.w) code |= OUT_LEFT;
+	if (p.x > p.w) code |= OUT_RIGHT;
+	if (p.y < -p.w) code |= OUT_BOTTOM;
+	if (p.y > p.w) code |= OUT_TOP;
+	if (p.z < -p.w) code |= OUT_NEAR;
+	if (p.z > p.w) code |= OUT_FAR;
+	if (p.x < -guardX * p.w) code |= OUT_GUARD_LEFT;
+	if (p.x > guardX * p.w) code |= OUT_GUARD_RIGHT;
+	if (p.y < -guardY * p.w) code |= OUT_GUARD_BOTTOM;
+	if (p.y > guardY * p.w) code |= OUT_GUARD_TOP;
+	return code;
+}
+
+// Perspective divide and viewport: NDC to pixels, depth to [0,1]; w keeps 1/w.
+static inline vec4 ToScreen(const vec4& p, const Viewport& viewport)
+{
+	float invW = 1.0f / p.w;
+	return vec4(viewport.x + (p.x * invW + 1) * 0.5f * viewport.width,
+		viewport.y + (p.y * invW + 1) * 0.5f * viewport.height, (p.z * invW + 1) * 0.5f, invW);
+}
+
+void Renderer::GetShadingContext(const DrawCommand& command, ShadingContext& context) const
+{
+	context.lights = m_lights.empty() ? NULL : &m_lights[0];
+	context.list = NULL;
+	context.count = (int)m_lights.size();
+	context.shadows = m_shadows.empty() ? NULL : &m_shadows[0];
+	for (int k = 0; k < 3; k++)
+	{
+		context.eye[k] = command.view.eye[k];
+		context.ambient[k] = m_ambient[k];
+	}
+	context.model = m_reflection;
+}
+
+// The values a command's fill interpolates for count of its vertices: for
+// Gouraud shading their lit colors, lit SHADE_BATCH at a time, for Phong
+// their world space normals and positions, and only the normals when
+// deferred.
+void Renderer::VertexAttributes(const DrawCommand& command, int first, int count, float* out) const
+{
+	const mat3& normalMatrix = command.normalMatrix;
+	if (command.deferred)
+	{
+		for (int i = first; i < first + count; i++, out += 3)
+		{
+			vec3 n = command.normals != NULL ? normalMatrix * (*command.normals)[i] : vec3(0, 0, 1);
+			out[0] = n.x;  out[1] = n.y;  out[2] = n.z;
+		}
+		return;
+	}
+	if (command.attributes == MAX_ATTRIBUTES)
+	{
+		for (int i = first; i < first + count; i++, out += MAX_ATTRIBUTES)
+		{
+			vec3 n = command.normals != NULL ? normalMatrix * (*command.normals)[i] : vec3(0, 0, 1);
+			vec4 p = ToClip(command.model, (*command.vertices)[i]);
+			out[0] = n.x;  out[1] = n.y;  out[2] = n.z;
+			out[3] = p.x;  out[4] = p.y;  out[5] = p.z;
+		}
+		return;
+	}
+
+	ShadingContext context;
+	GetShadingContext(command, context);
+	SurfaceBatch batch;
+	for (int j = 0; j < SHADE_BATCH; j++)
+	{
+		for (int k = 0; k < 3; k++)
+			batch.albedo[k][j] = command.color[k];
+		batch.specular[j] = command.specular;
+		batch.shininess[j] = command.shininess;
+	}
+	for (int b = 0; b < count; b += SHADE_BATCH)
+	{
+		// a short last batch repeats its last vertex
+		int lanes = (min)((int)SHADE_BATCH, count - b);
+		for (int j = 0; j < SHADE_BATCH; j++)
+		{
+			int i = first + b + (min)(j, lanes - 1);
+			vec3 n = command.normals != NULL ? normalMatrix * (*command.normals)[i] : vec3(0, 0, 1);
+			vec4 p = ToClip(command.model, (*command.vertices)[i]);
+			batch.nx[j] = n.x;  batch.ny[j] = n.y;  batch.nz[j] = n.z;
+			batch.px[j] = p.x;  batch.py[j] = p.y;  batch.pz[j] = p.z;
+		}
+		ShadeBatch(context, batch);
+		for (int j = 0; j < lanes; j++)
+			for (int k = 0; k < 3; k++)
+				out[3 * (b + j) + k] = batch.color[k][j];
+	}
+}
+
+void Renderer::TransformJob(void* data, int begin, int end)
+{
+	Renderer* self = (Renderer*)data;
+	int cmd = self->FindCommand(begin);
+	int commandEnd = cmd + 1 < (int)self->m_frameCommands.size() ? self->m_frameCommands[cmd+1].firstVertex : self->m_vertexCount;
+	float guardX = GuardX(self->m_frameCommands[cmd].view.viewport), guardY = GuardY(self->m_frameCommands[cmd].view.viewport);
+	for (int i = begin; i < end; i++)
+	{
+		while (i >= commandEnd)
+		{
+			cmd++;
+			commandEnd = cmd + 1 < (int)self->m_frameCommands.size() ? self->m_frameCommands[cmd+1].firstVertex : self->m_vertexCount;
+			guardX = GuardX(self->m_frameCommands[cmd].view.viewport);
+			guardY = GuardY(self->m_frameCommands[cmd].view.viewport);
+		}
+		const DrawCommand& command = self->m_frameCommands[cmd];
+		vec4 p = ToClip(command.mvp, (*command.vertices)[i - command.firstVertex]);
+		unsigned short code = Outcode(p, guardX, guardY);
+		self->m_outcodes[i] = code;
+		// the clipper projects its own vertices
+		if ((code & OUT_CLIP) == 0)
+			self->m_screen[i] = ToScreen(p, command.view.viewport);
+	}
+
+	// attributes, a run of vertices per command
+	for (int i = begin; i < end; )
+	{
+		const DrawCommand& command = self->m_frameCommands[self->FindCommand(i)];
+		int runEnd = (min)(end, command.firstVertex + (int)(command.vertices->size() - command.vertices->size() % 3));
+		if (command.attributes > 0)
+			self->VertexAttributes(command, i - command.firstVertex, runEnd - i,
+				self->m_attributes + command.firstAttribute + (i - command.firstVertex) * command.attributes);
+		i = runEnd;
+	}
+}
+
+// A vertex being clipped, with the attributes interpolated along.
+struct ClipVertex
+{
+	vec4 p;
+	float attributes[MAX_ATTRIBUTES];
+};
+
+// Sutherland-Hodgman against the homogeneous half space dot(plane, p) >= 0.
+// Attributes are linear in clip space, so they are cut where p is.
+static int ClipPolygon(const ClipVertex* in, int count, const vec4& plane, int attributes, ClipVertex* out)
+{
+	int n = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const ClipVertex& p = in[i];
+		const ClipVertex& q = in[i + 1 < count ? i + 1 : 0];
+		float dp = dot(plane, p.p), dq = dot(plane, q.p);
+		if (dp >= 0)
+			out[n++] = p;
+		if ((dp >= 0) != (dq >= 0))
+		{
+			float t = dp / (dp - dq);
+			ClipVertex& r = out[n++];
+			r.p = p.p + t * (q.p - p.p);
+			for (int k = 0; k < attributes; k++)
+				r.attributes[k] = p.attributes[k] + t * (q.attributes[k] - p.attributes[k]);
+		}
+	}
+	return n;
+}
+
+int Renderer::ClipTriangle(int t, const DrawCommand& cmd, ClippedTriangle* out) const
+{
+	// clip space positions are recomputed, only clipped triangles need them
+	const Viewport& vp = cmd.view.viewport;
+	ClipVertex buffers[2][MAX_CLIP_VERTICES];
+	ClipVertex* polygon = buffers[0];
+	ClipVertex* scratch = buffers[1];
+	unsigned short codes = 0;
+	for (int k = 0; k < 3; k++)
+	{
+		int vertex = 3*t + k - cmd.firstVertex;
+		polygon[k].p = ToClip(cmd.mvp, (*cmd.vertices)[vertex]);
+		const float* attributes = m_attributes + cmd.firstAttribute + vertex * cmd.attributes;
+		for (int a = 0; a < cmd.attributes; a++)
+			polygon[k].attributes[a] = attributes[a];
+		codes |= m_outcodes[3*t + k];
+	}
+
+	float guardX = GuardX(vp), guardY = GuardY(vp);
+	const struct { unsigned short code; vec4 plane; } planes[] = {
+		{ OUT_NEAR, vec4(0, 0, 1, 1) },
+		{ OUT_FAR, vec4(0, 0, -1, 1) },
+		{ OUT_GUARD_LEFT, vec4(1, 0, 0, guardX) },
+		{ OUT_GUARD_RIGHT, vec4(-1, 0, 0, guardX) },
+		{ OUT_GUARD_BOTTOM, vec4(0, 1, 0, guardY) },
+		{ OUT_GUARD_TOP, vec4(0, -1, 0, guardY) },
+	};
+	int count = 3;
+	for (int i = 0; i < 6 && count >= 3; i++)
+	{
+		if ((codes & planes[i].code) == 0)
+			continue;
+		count = ClipPolygon(polygon, count, planes[i].plane, cmd.attributes, scratch);
+		swap(polygon, scratch);
+	}
+
+	// fan, in the original winding
+	int triangles = 0;
+	for (int k = 0; k < count; k++)
+		polygon[k].p = ToScreen(polygon[k].p, vp);
+	for (int k = 2; k < count; k++)
+	{
+		ClippedTriangle& piece = out[triangles++];
+		const ClipVertex* corners[3] = { &polygon[0], &polygon[k-1], &polygon[k] };
+		for (int c = 0; c < 3; c++)
+		{
+			piece.v[c] = corners[c]->p;
+			for (int a = 0; a < cmd.attributes; a++)
+				piece.attributes[c][a] = corners[c]->attributes[a];
+		}
+	}
+	return triangles;
+}
+
+// Culls the triangle or sets it up into binned[entry] and adds that entry
+// to the bins of the tiles it overlaps. Returns whether it was binned.
+bool Renderer::SetupTriangle(vector<int>* bins, int cmd, const vec4& a, const vec4& b, const vec4& c,
+	const float* const* attributes, BinnedTriangle* binned, int entry, TriangleStats& stats)
+{
+	const DrawCommand& command = m_frameCommands[cmd];
+	// positive for counter clockwise on screen
+	float area = EdgeFunction(a, b, c.x, c.y);
+	if (area == 0)
+	{
+		stats.degenerate++;
+		return false;
+	}
+	if (area * command.cullSign > 0)
+	{
+		stats.backfacing++;
+		return false;
+	}
+
+	// pixel centers inside the bounding box; a box around none of them, or
+	// around a single one the triangle misses, can't cover anything
+	int firstX = (int)ceil(min(a.x, min(b.x, c.x)) - 0.5f), lastX = (int)floor(max(a.x, max(b.x, c.x)) - 0.5f);
+	int firstY = (int)ceil(min(a.y, min(b.y, c.y)) - 0.5f), lastY = (int)floor(max(a.y, max(b.y, c.y)) - 0.5f);
+	if (firstX > lastX || firstY > lastY ||
+		(firstX == lastX && firstY == lastY && !CoversSample(a, b, c, area, firstX + 0.5f, firstY + 0.5f)))
+	{
+		stats.missedSamples++;
+		return false;
+	}
+
+	// tiles overlapped by the box, inside the viewport
+	const Viewport& vp = command.view.viewport;
+	int minX = max(vp.x, firstX), maxX = min(min(vp.x + vp.width, m_width) - 1, lastX);
+	int minY = max(vp.y, firstY), maxY = min(min(vp.y + vp.height, m_height) - 1, lastY);
+	if (minX > maxX || minY > maxY)
+	{
+		stats.outside++;
+		return false;
+	}
+
+	FillInput input;
+	input.v[0] = a;  input.v[1] = b;  input.v[2] = c;
+	for (int k = 0; k < 3; k++)
+	{
+		input.attributes[k] = attributes[k];
+		input.color[k] = command.color[k];
+	}
+	input.alpha = command.alpha;
+	input.specular = command.specular;
+	input.shininess = command.shininess;
+	input.material = command.material;
+	binned[entry].setup.init(input, command.attributes);
+	binned[entry].command = cmd;
+
+	minX = max(minX, 0) / TILE_SIZE;
+	minY = max(minY, 0) / TILE_SIZE;
+	maxX /= TILE_SIZE;
+	maxY /= TILE_SIZE;
+	for (int ty = minY; ty <= maxY; ty++)
+		for (int tx = minX; tx <= maxX; tx++)
+			bins[tx + ty * m_tilesX].push_back(entry);
+	stats.binned++;
+	return true;
+}
+
+void Renderer::BinJob(void* data, int chunk, int chunkEnd)
+{
+	Renderer* self = (Renderer*)data;
+	int tiles = self->m_tilesX * self->m_tilesY;
+	int triangles = self->m_vertexCount / 3;
+	const unsigned short* codes = self->m_outcodes;
+	FrameArena& arena = self->m_frameMemory.arena(JobSystem::instance().currentSlot());
+	for (; chunk < chunkEnd; chunk++)
+	{
+		vector<int>* bins = &self->m_bins[chunk * tiles];
+		for (int t = 0; t < tiles; t++)
+			bins[t].clear();
+
+		int first = (int)((long long)triangles * chunk / self->m_binChunks);
+		int last = (int)((long long)triangles * (chunk + 1) / self->m_binChunks);
+
+		// room for every triangle, and the pieces of those that need clipping
+		int clipping = 0;
+		for (int t = first; t < last; t++)
+		{
+			unsigned short a = codes[3*t], b = codes[3*t+1], c = codes[3*t+2];
+			if ((a & b & c & OUT_FRUSTUM) == 0 && ((a | b | c) & OUT_CLIP) != 0)
+				clipping++;
+		}
+		TriangleStats& stats = self->m_chunkStats[chunk];
+		stats.clear();
+		stats.submitted = last - first;
+		stats.clipped = clipping;
+		BinnedTriangle* binned = arena.allocate<BinnedTriangle>(last - first + clipping * (MAX_CLIP_TRIANGLES - 1));
+		self->m_binned[chunk] = binned;
+		int binnedCount = 0;
+
+		int cmd = self->FindCommand(3 * first);
+		for (int t = first; t < last; t++)
+		{
+			while (cmd + 1 < (int)self->m_frameCommands.size() && self->m_frameCommands[cmd+1].firstVertex <= 3 * t)
+				cmd++;
+			unsigned short a = codes[3*t], b = codes[3*t+1], c = codes[3*t+2];
+			// all out on one side: trivial reject
+			if ((a & b & c & OUT_FRUSTUM) != 0)
+			{
+				stats.outside++;
+				continue;
+			}
+			const DrawCommand& command = self->m_frameCommands[cmd];
+			// all inside the guard band and depth range: trivial accept
+			if (((a | b | c) & OUT_CLIP) == 0)
+			{
+				const float* attributes[3] = { NULL, NULL, NULL };
+				if (command.attributes > 0)
+					for (int k = 0; k < 3; k++)
+						attributes[k] = self->m_attributes + command.firstAttribute + (3*t + k - command.firstVertex) * command.attributes;
+				const vec4* v = &self->m_screen[3*t];
+				if (self->SetupTriangle(bins, cmd, v[0], v[1], v[2], attributes, binned, binnedCount, stats))
+					binnedCount++;
+				continue;
+			}
+			ClippedTriangle pieces[MAX_CLIP_TRIANGLES];
+			int count = self->ClipTriangle(t, command, pieces);
+			for (int k = 0; k < count; k++)
+			{
+				const ClippedTriangle& piece = pieces[k];
+				const float* attributes[3] = { piece.attributes[0], piece.attributes[1], piece.attributes[2] };
+				if (self->SetupTriangle(bins, cmd, piece.v[0], piece.v[1], piece.v[2], attributes, binned, binnedCount, stats))
+					binnedCount++;
+			}
+		}
+	}
+}
+
+void Renderer::RasterJob(void* data, int tile, int tileEnd)
+{
+	Renderer* self = (Renderer*)data;
+	FillTarget target;
+	target.color = self->m_outBuffer;
+	target.depth = self->m_zbuffer;
+	target.gbuffer = self->m_gbuffer.empty() ? NULL : &self->m_gbuffer[0];
+	target.stride = self->m_stride;
+	ShadingContext shading;
+	target.shading = &shading;
+	for (; tile < tileEnd; tile++)
+	{
+		// deferred draws go first, into the G-buffer, and are lit before the
+		// others are drawn over them; then the depth of the draws with a
+		// pre-pass, so that they only light what stays visible
+		if (self->m_deferredCommands > 0)
+		{
+			self->DrawTile(tile, PASS_DEFERRED, target, shading);
+			self->ResolveTile(tile);
+		}
+		if (self->m_prepassCommands > 0)
+		{
+			self->DrawTile(tile, PASS_DEPTH, target, shading);
+			if (!self->m_lights.empty())
+				self->CullPrepassLights(tile);
+		}
+		if (self->m_deferredCommands < (int)self->m_frameCommands.size())
+			self->DrawTile(tile, PASS_FORWARD, target, shading);
+	}
+}
+
+// Fills the tile with its triangles of the commands drawn in this pass.
+void Renderer::DrawTile(int tile, TilePass pass, FillTarget& target, ShadingContext& shading) const
+{
+	int tiles = m_tilesX * m_tilesY;
+	int x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+	int shadingCommand = -1;
+	for (int chunk = 0; chunk < m_binChunks; chunk++)
+	{
+		const vector<int>& bin = m_bins[chunk * tiles + tile];
+		const BinnedTriangle* binned = m_binned[chunk];
+		for (size_t i = 0; i < bin.size(); i++)
+		{
+			const BinnedTriangle& triangle = binned[bin[i]];
+			const DrawCommand& cmd = m_frameCommands[triangle.command];
+			if (pass == PASS_DEFERRED ? !cmd.deferred : pass == PASS_DEPTH ? cmd.depthFill == NULL : cmd.deferred)
+				continue;
+			// only this tile's pixels, and only inside the command's view
+			const Viewport& vp = cmd.view.viewport;
+			target.x0 = max(x0, vp.x);
+			target.y0 = max(y0, vp.y);
+			target.x1 = min(min(x0 + TILE_SIZE, m_width), vp.x + vp.width);
+			target.y1 = min(min(y0 + TILE_SIZE, m_height), vp.y + vp.height);
+			if (pass == PASS_DEPTH)
+			{
+				cmd.depthFill(target, triangle.setup);
+				continue;
+			}
+			if (cmd.attributes > 0 && !cmd.deferred && triangle.command != shadingCommand)
+			{
+				GetShadingContext(cmd, shading);
+				// lit pixels only go through the lights that reach the tile
+				if (cmd.attributes == MAX_ATTRIBUTES && shading.count > 0)
+				{
+					const vector<vector<int> >& lists = cmd.depthFill != NULL ? m_prepassLights : m_tileLights;
+					const vector<int>& lights = lists[cmd.viewIndex * tiles + tile];
+					shading.list = lights.empty() ? NULL : &lights[0];
+					shading.count = (int)lights.size();
+				}
+				shadingCommand = triangle.command;
+			}
+			cmd.fill(target, triangle.setup);
+		}
+	}
+}
+
+static inline float StoredDepth(const void* depth, DepthFormat format, int i)
+{
+	if (format == DEPTH_UNORM16)
+		return ((const unsigned short*)depth)[i] * (1 / 65535.0f);
+	return ((const float*)depth)[i];
+}
+
+// Lights count surfaces of a batch and writes them to their pixels. The
+// lanes past count repeat the first one.
+static void LightPixels(const ShadingContext& context, SurfaceBatch& batch, float* const* pixels, int count)
+{
+	for (int j = count; j < SHADE_BATCH; j++)
+	{
+		batch.px[j] = batch.px[0];  batch.py[j] = batch.py[0];  batch.pz[j] = batch.pz[0];
+		batch.nx[j] = batch.nx[0];  batch.ny[j] = batch.ny[0];  batch.nz[j] = batch.nz[0];
+		for (int k = 0; k < 3; k++)
+			batch.albedo[k][j] = batch.albedo[k][0];
+		batch.specular[j] = batch.specular[0];
+		batch.shininess[j] = batch.shininess[0];
+	}
+	ShadeBatch(context, batch);
+	for (int j = 0; j < count; j++)
+		for (int k = 0; k < 3; k++)
+			pixels[j][k] = batch.color[k][j];
+}
+
+// Lights the tile's G-buffer pixels, one view at a time. Their depths are
+// known by now, so the lights are culled against the frustum between the
+// nearest and farthest of them; positions are unprojected from depth, and
+// the pixels lit SHADE_BATCH at a time. Leaves the tile's G-buffer empty.
+void Renderer::ResolveTile(int tile)
+{
+	int x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+	int x1 = min(x0 + TILE_SIZE, m_width), y1 = min(y0 + TILE_SIZE, m_height);
+	vector<int>& lights = m_slotLights[JobSystem::instance().currentSlot()];
+	for (int v = 0; v < (int)m_frameViews.size(); v++)
+	{
+		const RenderView& view = m_frameViews[v];
+		const Viewport& vp = view.viewport;
+		int left = max(x0, vp.x), right = min(x1, vp.x + vp.width);
+		int bottom = max(y0, vp.y), top = min(y1, vp.y + vp.height);
+		if (left >= right || bottom >= top)
+			continue;
+
+		float minDepth = 1, maxDepth = 0;
+		for (int y = bottom; y < top; y++)
+			for (int x = left; x < right; x++)
+			{
+				const GBufferTexel& texel = m_gbuffer[x + y * m_stride];
+				if (texel.material == 0 || m_gbufferMaterials[texel.material - 1].view != v)
+					continue;
+				float depth = StoredDepth(m_zbuffer, m_depthFormat, x + y * m_stride);
+				minDepth = min(minDepth, depth);
+				maxDepth = max(maxDepth, depth);
+			}
+		if (minDepth > maxDepth)
+			continue;
+		CullLights(view, left, bottom, right, top, minDepth, maxDepth, lights);
+
+		ShadingContext context;
+		context.lights = m_lights.empty() ? NULL : &m_lights[0];
+		context.list = lights.empty() ? NULL : &lights[0];
+		context.count = (int)lights.size();
+		context.shadows = m_shadows.empty() ? NULL : &m_shadows[0];
+		for (int k = 0; k < 3; k++)
+		{
+			context.eye[k] = view.eye[k];
+			context.ambient[k] = m_ambient[k];
+		}
+		context.model = m_reflection;
+
+		const mat4& inverse = m_inverseViews[v];
+		SurfaceBatch batch;
+		float* pixels[SHADE_BATCH];
+		int count = 0;
+		for (int y = bottom; y < top; y++)
+		{
+			float ndcY = 2 * (y + 0.5f - vp.y) / vp.height - 1;
+			for (int x = left; x < right; x++)
+			{
+				GBufferTexel& texel = m_gbuffer[x + y * m_stride];
+				if (texel.material == 0 || m_gbufferMaterials[texel.material - 1].view != v)
+					continue;
+				const GBufferMaterial& material = m_gbufferMaterials[texel.material - 1];
+				float ndcX = 2 * (x + 0.5f - vp.x) / vp.width - 1;
+				float ndcZ = 2 * StoredDepth(m_zbuffer, m_depthFormat, x + y * m_stride) - 1;
+				float h[4];
+				for (int r = 0; r < 4; r++)
+					h[r] = inverse[r][0] * ndcX + inverse[r][1] * ndcY + inverse[r][2] * ndcZ + inverse[r][3];
+				float invW = 1 / h[3];
+				batch.px[count] = h[0] * invW;  batch.py[count] = h[1] * invW;  batch.pz[count] = h[2] * invW;
+				DecodeNormal(texel.normal, batch.nx[count], batch.ny[count], batch.nz[count]);
+				for (int k = 0; k < 3; k++)
+					batch.albedo[k][count] = texel.albedo[k] * (1 / 255.0f);
+				batch.specular[count] = material.specular;
+				batch.shininess[count] = material.shininess;
+				pixels[count] = m_outBuffer + 3 * (x + y * m_stride);
+				texel.material = 0;
+				if (++count == SHADE_BATCH)
+				{
+					LightPixels(context, batch, pixels, count);
+					count = 0;
+				}
+			}
+		}
+		if (count > 0)
+			LightPixels(context, batch, pixels, count);
+	}
+}
+
+// The pre-pass left the depth of every pixel the draws with one will light,
+// so their lights are culled against the frustum between the nearest and
+// farthest depth of the tile in each view. Pixels at the far plane are
+// taken for cleared.
+void Renderer::CullPrepassLights(int tile)
+{
+	int tiles = m_tilesX * m_tilesY;
+	int x0 = (tile % m_tilesX) * TILE_SIZE, y0 = (tile / m_tilesX) * TILE_SIZE;
+	int x1 = min(x0 + TILE_SIZE, m_width), y1 = min(y0 + TILE_SIZE, m_height);
+	for (int v = 0; v < (int)m_frameViews.size(); v++)
+	{
+		const Viewport& vp = m_frameViews[v].viewport;
+		vector<int>& lights = m_prepassLights[v * tiles + tile];
+		int left = max(x0, vp.x), right = min(x1, vp.x + vp.width);
+		int bottom = max(y0, vp.y), top = min(y1, vp.y + vp.height);
+		float minDepth = 1, maxDepth = 0;
+		for (int y = bottom; y < top; y++)
+			for (int x = left; x < right; x++)
+			{
+				float depth = StoredDepth(m_zbuffer, m_depthFormat, x + y * m_stride);
+				if (depth < 1)
+				{
+					minDepth = min(minDepth, depth);
+					maxDepth = max(maxDepth, depth);
+				}
+			}
+		if (minDepth > maxDepth)
+			lights.clear();
+		else
+			CullLights(m_frameViews[v], left, bottom, right, top, minDepth, maxDepth, lights);
+	}
+}
+
+// Puts into list the lights that can light pixels x0..x1, y0..y1 of the view
+// at depths minDepth..maxDepth. These bound a frustum whose planes come
+// straight from the rows of the view projection matrix (a world space point
+// p is inside the left one where row0.p >= left * row3.p, with left in NDC,
+// and so on); a point or spot light is left out when the sphere its range
+// reaches is wholly outside one of the planes. Directional lights reach
+// everything.
+void Renderer::CullLights(const RenderView& view, int x0, int y0, int x1, int y1, float minDepth, float maxDepth,
+	vector<int>& list) const
+{
+	list.clear();
+	const Viewport& vp = view.viewport;
+	x0 = max(x0, vp.x);  x1 = min(x1, vp.x + vp.width);
+	y0 = max(y0, vp.y);  y1 = min(y1, vp.y + vp.height);
+	if (x0 >= x1 || y0 >= y1)
+		return;
+
+	// the tile's bounds in NDC, and a plane for each as +-(row - bound * row3)
+	const float bounds[6] = {
+		2.0f * (x0 - vp.x) / vp.width - 1, 2.0f * (x1 - vp.x) / vp.width - 1,
+		2.0f * (y0 - vp.y) / vp.height - 1, 2.0f * (y1 - vp.y) / vp.height - 1,
+		2 * minDepth - 1, 2 * maxDepth - 1 };
+	const mat4& m = view.viewProjection;
+	float planes[6][4];
+	for (int i = 0; i < 6; i++)
+	{
+		int row = i / 2;
+		float sign = (i & 1) ? -1.0f : 1.0f;
+		for (int k = 0; k < 4; k++)
+			planes[i][k] = sign * (m[row][k] - bounds[i] * m[3][k]);
+		// normalized, so a plane's value at a point is a distance
+		float length = sqrt(planes[i][0] * planes[i][0] + planes[i][1] * planes[i][1] + planes[i][2] * planes[i][2]);
+		if (length > 0)
+			for (int k = 0; k < 4; k++)
+				planes[i][k] /= length;
+	}
+
+	for (size_t l = 0; l < m_lights.size(); l++)
+	{
+		const ShadingLight& light = m_lights[l];
+		bool inside = true;
+		if (light.type != LIGHT_DIRECTIONAL)
+			for (int i = 0; i < 6 && inside; i++)
+				inside = planes[i][0] * light.position[0] + planes[i][1] * light.position[1] +
+					planes[i][2] * light.position[2] + planes[i][3] >= -light.range;
+		if (inside)
+			list.push_back((int)l);
+	}
+}
+
+void Renderer::LightCullJob(void* data, int tile, int tileEnd)
+{
+	Renderer* self = (Renderer*)data;
+	int tiles = self->m_tilesX * self->m_tilesY;
+	for (; tile < tileEnd; tile++)
+	{
+		int x0 = (tile % self->m_tilesX) * TILE_SIZE, y0 = (tile / self->m_tilesX) * TILE_SIZE;
+		int x1 = min(x0 + TILE_SIZE, self->m_width), y1 = min(y0 + TILE_SIZE, self->m_height);
+		// nothing is known yet of the depths the tile will end up with
+		for (size_t v = 0; v < self->m_frameViews.size(); v++)
+			self->CullLights(self->m_frameViews[v], x0, y0, x1, y1, 0, 1, self->m_tileLights[v * tiles + tile]);
+	}
 }
 
 void Renderer::SetDemoBuffer()
 {
 	//vertical line
-	for(int i=0; i<m_width; i++)
+	for(int i=0; i<m_height && 256<m_width; i++)
 	{
-		m_outBuffer[INDEX(m_width,256,i,0)]=1;	m_outBuffer[INDEX(m_width,256,i,1)]=0;	m_outBuffer[INDEX(m_width,256,i,2)]=0;
+		m_outBuffer[INDEX(m_stride,256,i,0)]=1;	m_outBuffer[INDEX(m_stride,256,i,1)]=0;	m_outBuffer[INDEX(m_stride,256,i,2)]=0;
 
 	}
 	//horizontal line
-	for(int i=0; i<m_width; i++)
+	for(int i=0; i<m_width && 256<m_height; i++)
 	{
-		m_outBuffer[INDEX(m_width,i,256,0)]=1;	m_outBuffer[INDEX(m_width,i,256,1)]=0;	m_outBuffer[INDEX(m_width,i,256,2)]=1;
+		m_outBuffer[INDEX(m_stride,i,256,0)]=1;	m_outBuffer[INDEX(m_stride,i,256,1)]=0;	m_outBuffer[INDEX(m_stride,i,256,2)]=1;
 
 	}
 }
@@ -51,6 +1126,46 @@ void Renderer::SetDemoBuffer()
 
 
 
+void Renderer::SwapBuffers()
+{
+	Flush();
+	bool rescaled = EndFrame();
+	PresentFrame(m_frames.back());
+	m_frameMemory.reset();
+	if (rescaled)
+		CreateBuffers(m_outputWidth, m_outputHeight);
+}
+
+// Times the frame just drawn. Returns true if the next one is drawn at
+// another scale.
+bool Renderer::EndFrame()
+{
+	m_lastFrameTime = chrono::duration<float, milli>(chrono::steady_clock::now() - m_frameStart).count();
+	m_lastFrameStats = m_frameStats;
+	m_frameStats.clear();
+	long long allocations = GetAllocationCount();
+	m_lastFrameAllocations = allocations - m_allocationsAtFrameEnd;
+	m_allocationsAtFrameEnd = allocations;
+	return m_dynamicResolution.update(m_lastFrameTime);
+}
+
+void Renderer::PublishFrame()
+{
+	Flush();
+	EndFrame();
+	m_frameMemory.reset();
+	m_frames.publish();
+	// the next frame goes into the buffer given back, at the same size
+	CreateBuffers(m_outputWidth, m_outputHeight);
+}
+
+bool Renderer::ShowLatestFrame()
+{
+	bool fresh = m_frames.consume();
+	PresentFrame(m_frames.front());
+	return fresh;
+}
+
 /////////////////////////////////////////////////////
 //OpenGL stuff. Don't touch.
 
@@ -64,6 +1179,7 @@ void Renderer::InitOpenGLRendering()
 	GLuint buffer;
 	glBindVertexArray(gScreenVtc);
 	glGenBuffers(1, &buffer);
+	gScreenBuf = buffer;
 	const GLfloat vtc[]={
 		-1, -1,
 		1, -1,
@@ -100,24 +1216,60 @@ void Renderer::InitOpenGLRendering()
 	a = glGetError();
 }
 
-void Renderer::CreateOpenGLBuffer()
+void Renderer::CreateOpenGLBuffer(const FrameBuffer& frame)
 {
+	// the texture matches the pooled storage, and only the used part of it
+	// is sampled; it is reallocated only together with the storage
 	glActiveTexture(GL_TEXTURE0);
 	glBindTexture(GL_TEXTURE_2D, gScreenTex);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_width, m_height, 0, GL_RGB, GL_FLOAT, NULL);
-	glViewport(0, 0, m_width, m_height);
+	if (m_texWidth != frame.getStride() || m_texHeight != frame.getAllocatedHeight())
+	{
+		m_texWidth = frame.getStride();
+		m_texHeight = frame.getAllocatedHeight();
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, m_texWidth, m_texHeight, 0, GL_RGB, GL_FLOAT, NULL);
+		// frames are only ever stretched, never shrunk: no mipmaps
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	m_shownWidth = frame.getWidth();
+	m_shownHeight = frame.getHeight();
+	// from the first texel's center to the last's, so filtering never
+	// reaches the texels past the frame, which are never uploaded
+	GLfloat s0 = 0.5f / m_texWidth, s1 = (m_shownWidth - 0.5f) / m_texWidth;
+	GLfloat t0 = 0.5f / m_texHeight, t1 = (m_shownHeight - 0.5f) / m_texHeight;
+	const GLfloat tex[]={
+		s0,t0,
+		s1,t0,
+		s0,t1,
+		s0,t1,
+		s1,t0,
+		s1,t1};
+	glBindBuffer(GL_ARRAY_BUFFER, gScreenBuf);
+	glBufferSubData( GL_ARRAY_BUFFER, 12*sizeof(GLfloat), sizeof(tex), tex);
 }
 
-void Renderer::SwapBuffers()
+void Renderer::PresentFrame(const FrameBuffer& frame)
 {
+	if (frame.color() == NULL)
+		return;
+	if (!m_glReady)
+	{
+		InitOpenGLRendering();
+		m_glReady = true;
+	}
+	if (m_texWidth != frame.getStride() || m_texHeight != frame.getAllocatedHeight() ||
+		m_shownWidth != frame.getWidth() || m_shownHeight != frame.getHeight())
+		CreateOpenGLBuffer(frame);
 
 	int a = glGetError();
 	glActiveTexture(GL_TEXTURE0);
 	a = glGetError();
 	glBindTexture(GL_TEXTURE_2D, gScreenTex);
 	a = glGetError();
-	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGB, GL_FLOAT, m_outBuffer);
-	glGenerateMipmap(GL_TEXTURE_2D);
+	// rows are padded, tell GL how far apart they are
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, frame.getStride());
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, frame.getWidth(), frame.getHeight(), GL_RGB, GL_FLOAT, frame.color());
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
 	a = glGetError();
 
 	glBindVertexArray(gScreenVtc);
@@ -126,4 +1278,4 @@ void Renderer::SwapBuffers()
 	a = glGetError();
 	glutSwapBuffers();
 	a = glGetError();
-}
\ No newline at end of file
+}
@@ -1,18 +1,227 @@
 #pragma once
 #include <vector>
+#include <chrono>
 #include "CG_skel_w_MFC.h"
 #include "vec.h"
 #include "mat.h"
 #include "GL/glew.h"
+#include "FrameArena.h"
+#include "FrameBuffer.h"
+#include "JobSystem.h"
+#include "TripleBuffer.h"
+#include "Rasterizer.h"
+#include "DynamicResolution.h"
 
 using namespace std;
+
+struct Material
+{
+	vec3 color;
+	float alpha;	// for blending
+	float specular;		// highlight strength, when lit
+	float shininess;	// highlight exponent
+
+	Material() : color(0.8f, 0.8f, 0.8f), alpha(1.0f), specular(0.3f), shininess(32.0f) {}
+};
+
+// Pixel rectangle of the frame a view draws into, origin at the bottom left.
+struct Viewport
+{
+	int x, y, width, height;
+
+	Viewport() : x(0), y(0), width(0), height(0) {}
+	Viewport(int x, int y, int width, int height) : x(x), y(y), width(width), height(height) {}
+};
+
+// Triangles of a frame and what became of them in setup; each removed
+// triangle is counted by the first test that removed it.
+struct TriangleStats
+{
+	int submitted;
+	int outside;		// all vertices out on one side of the frustum, or off the viewport
+	int clipped;		// went through the clipper (then counted again, per piece)
+	int degenerate;		// zero area
+	int backfacing;
+	int missedSamples;	// covers no pixel center
+	int binned;		// handed to the rasterizer
+
+	TriangleStats() { clear(); }
+	void clear() { submitted = outside = clipped = degenerate = backfacing = missedSamples = binned = 0; }
+	void add(const TriangleStats& s)
+	{
+		submitted += s.submitted;  outside += s.outside;  clipped += s.clipped;  degenerate += s.degenerate;
+		backfacing += s.backfacing;  missedSamples += s.missedSamples;  binned += s.binned;
+	}
+};
+
+// What a draw needs to know about the view it renders.
+struct RenderView
+{
+	Viewport viewport;
+	mat4 viewProjection;
+	vec3 eye;	// camera position in world space, for lighting
+};
+
+// Camera position in world space from a rigid view (world to camera)
+// matrix [R | t]: -R^T t.
+inline vec3 EyePosition(const mat4& view)
+{
+	vec3 eye;
+	for (int i = 0; i < 3; i++)
+		eye[i] = -(view[0][i] * view[0][3] + view[1][i] * view[1][3] + view[2][i] * view[2][3]);
+	return eye;
+}
+
 class Renderer
 {
-	float *m_outBuffer; // 3*width*height
-	float *m_zbuffer; // width*height
-	int m_width, m_height;
+	// Frames being drawn, finished and shown. Drawing always targets
+	// m_frames.back(); see PublishFrame() for handing frames to another thread.
+	TripleBuffer<FrameBuffer> m_frames;
+	float *m_outBuffer; // 3*stride*height, owned by m_frames.back()
+	void *m_zbuffer; // stride*height in m_depthFormat, owned by m_frames.back()
+	int m_width, m_height;	// drawn, a fraction of the output size
+	int m_outputWidth, m_outputHeight;
+	float m_resolutionScale;
+	DynamicResolution m_dynamicResolution;	// on top of m_resolutionScale
+	chrono::steady_clock::time_point m_frameStart;	// at the color clear
+	float m_lastFrameTime;	// ms
+	long long m_allocationsAtFrameEnd;	// process wide count, see AllocationCounter.h
+	long long m_lastFrameAllocations;
+	int m_stride; // pixels from one row to the next
+
+	mat4 m_cTransform;
+	mat4 m_projection;
+	RenderView m_view;	// used by the draws that don't name a view
+	mat4 m_oTransform;
+	mat3 m_nTransform;
+	Material m_material;
+	int m_cullFace, m_frontFace;
+	int m_shading;
+	int m_renderPath;
+	ReflectionModel m_reflection;
+	vector<ShadingLight> m_lights;	// of the frame
+	vector<ShadowMap> m_shadows;	// of m_lights
+	vec3 m_ambient;
+	bool m_depthTest;
+	DepthFormat m_depthFormat;
+	BlendMode m_blendMode;
+
+	FrameMemory m_frameMemory;	// one arena per job slot, reset by SwapBuffers
+
+	// Between BeginShadowMap() and EndShadowMap(), draws go to a shadow map
+	// and the frame's planes and size wait here.
+	bool m_shadowPass;
+	float* m_frameOutBuffer;
+	void* m_frameZBuffer;
+	int m_frameWidth, m_frameHeight, m_frameStride;
+
+	// Draw calls only record commands; Flush() transforms all their vertices,
+	// sets up and bins the triangles into screen tiles and rasterizes the
+	// tiles, each stage spread over the job system. Binning also rejects triangles
+	// outside the view and clips the few that cross the near or far plane or
+	// leave the guard band; everything else is left to the tile scissor.
+	struct DrawCommand
+	{
+		RenderView view;
+		int viewIndex;	// into m_frameViews, set by Flush()
+		mat4 mvp;
+		mat4 model;
+		mat3 normalMatrix;	// of model, for world space normals
+		const vector<vec3>* vertices;
+		const vector<vec3>* normals;
+		vec3 color;
+		float alpha;
+		float specular, shininess;
+		FillState state;
+		FillFunction fill;	// specialized for state
+		// PATH_DEPTH_PREPASS: the depth only fill of the first pass, fill
+		// then draws where the depth is equal; NULL for other draws
+		FillFunction depthFill;
+		float cullSign;		// triangles whose signed area has this sign are culled, 0 for none
+		// per vertex values the fill interpolates: 0, 3 for Gouraud shaded
+		// colors or deferred normals, or MAX_ATTRIBUTES for world space
+		// normals and positions
+		int attributes;
+		bool deferred;		// drawn into the G-buffer, lit by ResolveTile()
+		int material;		// its G-buffer material, set by Flush()
+		int firstVertex;	// into m_screen, set by Flush()
+		int firstAttribute;	// into m_attributes, set by Flush()
+	};
+	vector<vector<DrawCommand> > m_commands;	// recorded, per job slot
+	vector<DrawCommand> m_frameCommands;	// being flushed
+	vector<RenderView> m_frameViews;	// the different views of m_frameCommands
+	vec4* m_screen;		// transformed vertices of all commands, where their outcode is inside
+	unsigned short* m_outcodes;	// of every vertex against the frustum and the guard band
+	float* m_attributes;	// per vertex values of the commands that have them
+	// The deferred path's G-buffer, stride pixels a row like the frame's
+	// planes, and what its material IDs stand for in the flush: ID i is
+	// m_gbufferMaterials[i - 1]. Pixels are only set between the G-buffer
+	// fill of a tile and its resolve, everything else has material 0.
+	struct GBufferMaterial
+	{
+		float specular, shininess;
+		int view;	// into m_frameViews
+	};
+	vector<GBufferTexel> m_gbuffer;
+	vector<GBufferMaterial> m_gbufferMaterials;
+	vector<mat4> m_inverseViews;	// of m_frameViews, to unproject the G-buffer's depths
+	vector<vector<int> > m_slotLights;	// per job slot, light lists of the tile being resolved
+	int m_deferredCommands;
+	int m_prepassCommands;	// with a depthFill
+	// [view * tiles + tile], like m_tileLights but for the draws with a
+	// depth pre-pass, culled once the tile's depths are known
+	vector<vector<int> > m_prepassLights;
+	// Screen space pieces of a clipped triangle, with their attributes.
+	struct ClippedTriangle
+	{
+		vec4 v[3];
+		float attributes[3][MAX_ATTRIBUTES];
+	};
+	// Triangles that made it through setup. Bins refer to them by index
+	// into their chunk's array, which lives in the arena of the thread that
+	// binned the chunk.
+	struct BinnedTriangle
+	{
+		TriangleSetup setup;
+		int command;
+	};
+	vector<BinnedTriangle*> m_binned;	// per bin chunk
+	int m_vertexCount;
+	int m_attributeCount;
+	enum { TILE_SIZE = 64, MAX_BIN_CHUNKS = 64 };
+	int m_tilesX, m_tilesY;
+	int m_binChunks;
+	vector<vector<int> > m_bins;	// [chunk * tiles + tile], triangles in submission order
+	// [view * tiles + tile], indices into m_lights of the lights that can
+	// reach the tile in that view, for the pixels lit with SHADE_LIT
+	vector<vector<int> > m_tileLights;
+	TriangleStats m_chunkStats[MAX_BIN_CHUNKS];
+	TriangleStats m_frameStats, m_lastFrameStats;
+
+	void RecordMesh(const RenderView& view, const vector<vec3>* vertices, const vector<vec3>* normals,
+		const mat4& model, const mat4& mvp, const Material& material);
+	void GetShadingContext(const DrawCommand& command, ShadingContext& context) const;
+	int FindCommand(int vertex) const;
+	void VertexAttributes(const DrawCommand& command, int first, int count, float* out) const;
+	static void TransformJob(void* data, int begin, int end);
+	static void BinJob(void* data, int begin, int end);
+	static void RasterJob(void* data, int begin, int end);
+	static void LightCullJob(void* data, int begin, int end);
+	// the passes over a tile, in order: G-buffer fills, pre-pass depth fills, the rest
+	enum TilePass { PASS_DEFERRED, PASS_DEPTH, PASS_FORWARD };
+	void DrawTile(int tile, TilePass pass, FillTarget& target, ShadingContext& shading) const;
+	void ResolveTile(int tile);
+	void CullPrepassLights(int tile);
+	int FindView(const RenderView& view);
+	int FindMaterial(const DrawCommand& command);
+	void CullLights(const RenderView& view, int x0, int y0, int x1, int y1, float minDepth, float maxDepth,
+		vector<int>& list) const;
+	bool SetupTriangle(vector<int>* bins, int command, const vec4& a, const vec4& b, const vec4& c,
+		const float* const* attributes, BinnedTriangle* binned, int entry, TriangleStats& stats);
+	int ClipTriangle(int t, const DrawCommand& command, ClippedTriangle* out) const;
 
 	void CreateBuffers(int width, int height);
+	bool EndFrame();
 	void CreateLocalBuffer();
 
 	//////////////////////////////
@@ -20,7 +229,12 @@ class Renderer
 
 	GLuint gScreenTex;
 	GLuint gScreenVtc;
-	void CreateOpenGLBuffer();
+	GLuint gScreenBuf;
+	int m_texWidth, m_texHeight;
+	int m_shownWidth, m_shownHeight;
+	bool m_glReady;	// set up by the first frame shown, so drawing needs no GL context
+	void CreateOpenGLBuffer(const FrameBuffer& frame);
+	void PresentFrame(const FrameBuffer& frame);
 	void InitOpenGLRendering();
 	//////////////////////////////
 public:
@@ -28,11 +242,114 @@ public:
 	Renderer(int width, int height);
 	~Renderer(void);
 	void Init();
+	// Call on window reshape. Reuses the buffers' storage when it can.
+	// Doesn't touch OpenGL, the GL texture follows when a frame is shown.
+	void Resize(int width, int height);
+	// Draws at this fraction of the output's width and height, e.g. 0.5 for
+	// a quarter of the pixels; the frame is stretched over the output when
+	// shown. Storage stays reserved for the full size, so switching between
+	// scales doesn't reallocate.
+	void SetResolutionScale(float scale);
+	float GetResolutionScale() const { return m_resolutionScale; }
+	// Scales the resolution down further when frames take longer than this,
+	// and back up when there's time again; 0 turns it off. Frames are timed
+	// from ClearColorBuffer() to SwapBuffers() or PublishFrame().
+	void SetFrameBudget(float milliseconds);
+	float GetFrameBudget() const { return m_dynamicResolution.getBudget(); }
+	float GetDynamicResolutionScale() const { return m_dynamicResolution.getScale(); }
+	float GetLastFrameTime() const { return m_lastFrameTime; }
 	void DrawTriangles(const vector<vec3>* vertices, const vector<vec3>* normals=NULL);
 	void SetCameraTransform(const mat4& cTransform);
 	void SetProjection(const mat4& projection);
+	// Sets both camera matrices together with their precomputed product.
+	void SetCamera(const mat4& cTransform, const mat4& projection, const mat4& viewProjection);
+	// Limits the following draws to part of the frame. Reset to the whole
+	// frame whenever the buffers are recreated.
+	void SetViewport(const Viewport& viewport);
+	const Viewport& GetViewport() const { return m_view.viewport; }
 	void SetObjectMatrices(const mat4& oTransform, const mat3& nTransform);
+	void SetMaterial(const Material& material);
+	// Which faces the following draws skip, and which winding faces the
+	// viewer. Defaults are CULL_BACK and WINDING_CCW, as seen on screen.
+	enum { CULL_NONE, CULL_BACK, CULL_FRONT };
+	enum { WINDING_CCW, WINDING_CW };
+	void SetCullFace(int cullFace) { m_cullFace = cullFace; }
+	void SetFrontFace(int winding) { m_frontFace = winding; }
+	// How the following draws are lit: SHADING_NONE draws the material's
+	// color as is, SHADING_GOURAUD lights the vertices and interpolates
+	// their colors, SHADING_PHONG interpolates normals and lights every
+	// pixel. The default is SHADING_NONE.
+	enum { SHADING_NONE, SHADING_GOURAUD, SHADING_PHONG };
+	void SetShading(int shading) { m_shading = shading; }
+	// How Phong shaded draws get lit. PATH_FORWARD lights every pixel as
+	// it's drawn, overdraw included. PATH_DEFERRED draws their normals,
+	// albedo and material into a G-buffer and lights each visible pixel once,
+	// when flushed; their blended draws, and the draws not lit per pixel,
+	// are drawn forward after that. PATH_DEPTH_PREPASS draws their depth
+	// first, everywhere, then lights only the pixels where their depth is
+	// the one left in the depth buffer, which are about one per pixel; it
+	// needs the depth test, and blended draws are drawn forward. The
+	// default is PATH_FORWARD.
+	enum { PATH_FORWARD, PATH_DEFERRED, PATH_DEPTH_PREPASS };
+	void SetRenderPath(int path) { m_renderPath = path; }
+	int GetRenderPath() const { return m_renderPath; }
+	// The lights, in world space, and ambient light of everything drawn
+	// from now on in this frame, lit with Phong or Blinn-Phong reflection.
+	// Lights with a shadow index are shadowed by shadows[index]; the maps'
+	// depths must stay put while the lights are in use.
+	void SetLights(const ShadingLight* lights, int count, const vec3& ambient,
+		const ShadowMap* shadows=NULL, int shadowCount=0);
+	// Draws a shadow map: the draws between the two calls go into depth, a
+	// size x size float plane, instead of the frame, and only write depth,
+	// with both faces and whatever the other draw state. Name their view
+	// (the light's) and its viewport, which is usually the whole map.
+	// EndShadowMap() rasterizes them, spread over the job system like any
+	// flush, and goes back to the frame.
+	void BeginShadowMap(float* depth, int size);
+	void EndShadowMap();
+	void SetReflectionModel(ReflectionModel model);
+	// Depth test (less than, with writes) and blending of the following
+	// draws; each combination has a fill loop of its own (see Rasterizer.h).
+	void SetDepthTest(bool enabled) { m_depthTest = enabled; }
+	void SetBlendMode(BlendMode mode) { m_blendMode = mode; }
+	// Format of the depth buffer, for all draws. Clear the depth after
+	// changing it.
+	void SetDepthFormat(DepthFormat format);
+	// Draws one shared vertex array once per instance, without copying it.
+	void DrawTrianglesInstanced(const vector<vec3>* vertices, const vector<vec3>* normals,
+		const mat4* oTransforms, const Material* materials, int count);
+	// Same, for an explicit view. Records into the calling job slot's list,
+	// so different jobs may draw at the same time.
+	void DrawTrianglesInstanced(const RenderView& view, const vector<vec3>* vertices, const vector<vec3>* normals,
+		const mat4* oTransforms, const Material* materials, int count);
+	// Rasterizes everything drawn so far. SwapBuffers and the clears flush.
+	void Flush();
+	// Shows the frame drawn so far. Needs the GL context's thread.
 	void SwapBuffers();
+
+	// For drawing on a thread without the GL context: PublishFrame() ends a
+	// frame and hands it over without waiting, and ShowLatestFrame(), on the
+	// GL thread, shows the newest frame published. Returns false if that
+	// frame was already shown before.
+	void PublishFrame();
+	bool HasNewFrame() const { return m_frames.hasFresh(); }
+	bool ShowLatestFrame();
+
+	// Arenas for data that only lives until SwapBuffers, one per job slot
+	// (see JobSystem::currentSlot).
+	FrameArena& GetFrameArena(int slot) { return m_frameMemory.arena(slot); }
+	// operator new and delete calls the whole process made during the last
+	// frame, from the end of the one before; 0 once steady. Only counted in
+	// builds defining COUNT_ALLOCATIONS, see AllocationCounter.h.
+	long long GetFrameAllocations() const { return m_lastFrameAllocations; }
+	// what triangle setup did with the last frame's triangles
+	const TriangleStats& GetTriangleStats() const { return m_lastFrameStats; }
+	// size drawn at; see SetResolutionScale()
+	int GetWidth() const { return m_width; }
+	int GetHeight() const { return m_height; }
+	int GetOutputWidth() const { return m_outputWidth; }
+	int GetOutputHeight() const { return m_outputHeight; }
+	int GetBufferAllocationCount() const;
 	void ClearColorBuffer();
 	void ClearDepthBuffer();
 	void SetDemoBuffer();
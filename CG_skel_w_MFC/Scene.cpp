@@ -1,19 +1,420 @@
 #include "stdafx.h"
 #include "Scene.h"
 #include "MeshModel.h"
+#include "AssetCache.h"
 #include <string>
+#include <algorithm>
+#include "JobSystem.h"
 
 using namespace std;
+
+void Camera::changed()
+{
+	dirty = true;
+	version++;
+	if (scene != NULL)
+		scene->invalidate(Scene::DIRTY_CAMERA);
+}
+
+void Camera::setTransformation(const mat4& transform)
+{
+	cTransform = transform;
+	changed();
+}
+
+void Camera::LookAt(const vec4& eye, const vec4& at, const vec4& up)
+{
+	vec3 e(eye.x, eye.y, eye.z);
+	vec3 n = normalize(e - vec3(at.x, at.y, at.z));
+	vec3 u = normalize(cross(vec3(up.x, up.y, up.z), n));
+	vec3 v = cross(n, u);
+	cTransform = mat4(vec4(u, -dot(u, e)),
+		vec4(v, -dot(v, e)),
+		vec4(n, -dot(n, e)),
+		vec4(0, 0, 0, 1));
+	changed();
+}
+
+void Camera::Ortho( const float left, const float right,
+	const float bottom, const float top,
+	const float zNear, const float zFar )
+{
+	projection = mat4(vec4(2 / (right - left), 0, 0, -(right + left) / (right - left)),
+		vec4(0, 2 / (top - bottom), 0, -(top + bottom) / (top - bottom)),
+		vec4(0, 0, -2 / (zFar - zNear), -(zFar + zNear) / (zFar - zNear)),
+		vec4(0, 0, 0, 1));
+	changed();
+}
+
+void Camera::Frustum( const float left, const float right,
+	const float bottom, const float top,
+	const float zNear, const float zFar )
+{
+	projection = mat4(vec4(2 * zNear / (right - left), 0, (right + left) / (right - left), 0),
+		vec4(0, 2 * zNear / (top - bottom), (top + bottom) / (top - bottom), 0),
+		vec4(0, 0, -(zFar + zNear) / (zFar - zNear), -2 * zFar * zNear / (zFar - zNear)),
+		vec4(0, 0, -1, 0));
+	changed();
+}
+
+mat4 Camera::Perspective( const float fovy, const float aspect,
+	const float zNear, const float zFar)
+{
+	float top = zNear * tan(fovy * 0.5f * (float)M_PI / 180.0f);
+	float right = top * aspect;
+	Frustum(-right, right, -top, top, zNear, zFar);
+	return projection;
+}
+
+void Camera::refresh() const
+{
+	viewProjection = projection * cTransform;
+	frustum = ::Frustum(viewProjection);
+	dirty = false;
+}
+
+void Light::changed()
+{
+	if (scene != NULL)
+		scene->invalidate(Scene::DIRTY_LIGHTS);
+}
+
+void Light::setDirectional(const vec3& direction)
+{
+	type = LIGHT_DIRECTIONAL;
+	this->direction = normalize(direction);
+	changed();
+}
+
+void Light::setPoint(const vec3& position, float range)
+{
+	type = LIGHT_POINT;
+	this->position = position;
+	this->range = range;
+	changed();
+}
+
+void Light::setSpot(const vec3& position, const vec3& direction, float range, float innerAngle, float outerAngle)
+{
+	type = LIGHT_SPOT;
+	this->position = position;
+	this->direction = normalize(direction);
+	this->range = range;
+	this->innerAngle = innerAngle;
+	this->outerAngle = outerAngle;
+	changed();
+}
+
+void Light::setColor(const vec3& color, float intensity)
+{
+	this->color = color;
+	this->intensity = intensity;
+	changed();
+}
+
+void Light::setShadows(int size)
+{
+	shadowSize = (max)(size, 0);
+	changed();
+}
+
+ShadingLight Light::getShadingLight() const
+{
+	ShadingLight light;
+	light.type = type;
+	for (int k = 0; k < 3; k++)
+	{
+		light.position[k] = position[k];
+		light.direction[k] = direction[k];
+		light.color[k] = color[k] * intensity;
+	}
+	light.range = range;
+	light.invRangeSquared = 1 / (range * range);
+	float toRadians = (float)M_PI / 180.0f;
+	light.cosOuter = cos(outerAngle * toRadians);
+	float cosInner = cos((min)(innerAngle, outerAngle) * toRadians);
+	light.spotScale = cosInner > light.cosOuter ? 1 / (cosInner - light.cosOuter) : 1e6f;
+	light.shadow = -1;
+	return light;
+}
+
+Scene::~Scene()
+{
+	for (int d = 0; d < m_registry.size(); d++)
+		delete m_registry.facade(d);
+	for (size_t i = 0; i < cameras.size(); i++)
+		delete cameras[i];
+	for (size_t i = 0; i < lights.size(); i++)
+		delete lights[i];
+}
+
+int Scene::addCamera(Camera* camera)
+{
+	cameras.push_back(camera);
+	camera->scene = this;
+	invalidate(DIRTY_CAMERA);
+	return (int)cameras.size() - 1;
+}
+
+int Scene::addLight(Light* light)
+{
+	lights.push_back(light);
+	light->scene = this;
+	invalidate(DIRTY_LIGHTS);
+	return (int)lights.size() - 1;
+}
+
 void Scene::loadOBJModel(string fileName)
 {
-	MeshModel *model = new MeshModel(fileName);
-	models.push_back(model);
+	loadOBJModels(vector<string>(1, fileName));
+}
+
+// Files of one loadOBJModels call and the geometry parsed from each.
+struct LoadBatch
+{
+	const vector<string>* fileNames;
+	vector<MeshGeometryPtr> geometry;
+};
+
+static void loadMeshJob(void* data, int begin, int end)
+{
+	LoadBatch* batch = (LoadBatch*)data;
+	for (int i = begin; i < end; i++)
+		batch->geometry[i] = AssetCache::instance().loadMesh((*batch->fileNames)[i]);
+}
+
+void Scene::loadOBJModels(const vector<string>& fileNames)
+{
+	// files are parsed concurrently; opening the same file again reuses the
+	// already parsed geometry
+	LoadBatch batch;
+	batch.fileNames = &fileNames;
+	batch.geometry.resize(fileNames.size());
+	JobSystem& jobs = JobSystem::instance();
+	JobCounter loaded;
+	jobs.parallelFor(loadMeshJob, &batch, (int)fileNames.size(), 1, loaded);
+	jobs.wait(loaded);
+
+	// the scene itself is only changed here, in order
+	for (size_t i = 0; i < batch.geometry.size(); i++)
+		if (batch.geometry[i])
+			addModel(new MeshModel(batch.geometry[i]));
+}
+
+ModelHandle Scene::addModel(Model* model, ModelHandle parent)
+{
+	int p = m_registry.dense(parent);
+	int parentNode = p < 0 ? TransformHierarchy::NO_PARENT : m_registry.node(p);
+
+	MeshGeometryPtr geometry;
+	Material material;
+	MeshModel* mesh = dynamic_cast<MeshModel*>(model);
+	if (mesh != NULL)
+	{
+		geometry = mesh->getGeometry();
+		material = mesh->getMaterial();
+	}
+
+	ModelHandle handle = m_registry.create(model, parentNode, geometry, material);
+	model->registry = &m_registry;
+	model->handle = handle;
+
+	// the real world bounds arrive with the first update()
+	int d = m_registry.dense(handle);
+	if (m_registry.mesh(d) >= 0)
+		m_bvh.insert(handle.slot, m_registry.localBounds(d));
+	else
+		m_unbatched.push_back(handle.slot);
+	invalidate(DIRTY_MODELS);
+	return handle;
+}
+
+void Scene::removeModel(ModelHandle model)
+{
+	int d = m_registry.dense(model);
+	if (d < 0)
+		return;
+	Model* facade = m_registry.facade(d);
+	if (m_registry.mesh(d) >= 0)
+		m_bvh.remove(model.slot);
+	else
+		m_unbatched.erase(find(m_unbatched.begin(), m_unbatched.end(), model.slot));
+	m_registry.destroy(model);
+	delete facade;
+	invalidate(DIRTY_MODELS);
+}
+
+ModelHandle Scene::instanceModel(ModelHandle model, ModelHandle parent)
+{
+	int d = m_registry.dense(model);
+	if (d < 0 || m_registry.mesh(d) < 0)
+		return ModelHandle();
+	MeshModel* instance = new MeshModel(m_registry.meshGeometry(m_registry.mesh(d)));
+	instance->setMaterial(m_registry.material(d));
+	return addModel(instance, parent);
+}
+
+void Scene::setParent(ModelHandle model, ModelHandle parent)
+{
+	int d = m_registry.dense(model);
+	if (d < 0)
+		return;
+	int p = m_registry.dense(parent);
+	int parentNode = p < 0 ? TransformHierarchy::NO_PARENT : m_registry.node(p);
+	m_registry.transforms().setParent(m_registry.node(d), parentNode);
+	invalidate(DIRTY_TRANSFORMS);
+}
+
+void Scene::setModelTransform(ModelHandle model, const mat4& transform)
+{
+	int d = m_registry.dense(model);
+	if (d < 0)
+		return;
+	m_registry.transforms().setLocal(m_registry.node(d), transform);
+	invalidate(DIRTY_TRANSFORMS);
+}
+
+const mat4& Scene::getModelWorldTransform(ModelHandle model) const
+{
+	return m_registry.transforms().world(m_registry.node(m_registry.dense(model)));
+}
+
+void Scene::update()
+{
+	// only subtrees touched since the last frame are recomputed
+	TransformHierarchy& transforms = m_registry.transforms();
+	transforms.update();
+
+	// and only their bounds are recomputed, in parallel, then refit in the BVH
+	const vector<int>& updated = transforms.updatedNodes();
+	JobSystem& jobs = JobSystem::instance();
+	JobCounter bounded;
+	jobs.parallelFor(updateBoundsJob, this, (int)updated.size(), 256, bounded);
+	jobs.wait(bounded);
+	for (size_t i = 0; i < updated.size(); i++)
+	{
+		int d = m_registry.denseOfNode(updated[i]);
+		if (d >= 0 && m_registry.mesh(d) >= 0)
+			m_bvh.setBounds(m_registry.slot(d), m_registry.worldBounds(d));
+	}
+	m_bvh.update();
+}
+
+void Scene::updateBoundsJob(void* data, int begin, int end)
+{
+	Scene* scene = (Scene*)data;
+	ModelRegistry& registry = scene->m_registry;
+	const TransformHierarchy& transforms = registry.transforms();
+	const vector<int>& updated = transforms.updatedNodes();
+	for (int i = begin; i < end; i++)
+	{
+		int d = registry.denseOfNode(updated[i]);
+		if (d < 0 || registry.mesh(d) < 0)
+			continue;
+		registry.setWorldBounds(d, TransformBounds(registry.localBounds(d), transforms.world(updated[i])));
+	}
+}
+
+void Scene::addView(int camera, float left, float bottom, float width, float height)
+{
+	SceneView view = { camera, left, bottom, width, height };
+	views.push_back(view);
+	invalidate(DIRTY_VIEWS);
+}
+
+void Scene::invalidate(unsigned what)
+{
+	bool wasClean = m_dirty == 0;
+	m_dirty |= what;
+	if (what & (DIRTY_MODELS | DIRTY_TRANSFORMS))
+		m_casterVersion++;
+	if (wasClean && m_redisplay != NULL)
+		m_redisplay();
+}
+
+void Scene::snapshot(SceneSnapshot& snapshot, int width, int height)
+{
+	update();
+	m_dirty = 0;
+	snapshot.width = width;
+	snapshot.height = height;
+
+	snapshot.cameras.resize(cameras.size());
+	for (size_t i = 0; i < cameras.size(); i++)
+	{
+		// matrices and planes are cached by the camera until it moves
+		CameraState& state = snapshot.cameras[i];
+		state.view = cameras[i]->getTransformation();
+		state.projection = cameras[i]->getProjection();
+		state.viewProjection = cameras[i]->getViewProjection();
+		state.frustum = cameras[i]->getFrustum();
+	}
+	snapshot.lights.resize(lights.size());
+	snapshot.shadowSizes.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		snapshot.lights[i] = lights[i]->getShadingLight();
+		snapshot.shadowSizes[i] = lights[i]->getShadowSize();
+	}
+	snapshot.casterVersion = m_casterVersion;
+	snapshot.ambient = m_ambient;
+	snapshot.views = views;
+	snapshot.activeCamera = activeCamera;
+	snapshot.lodHiddenPixels = lodHiddenPixels;
+
+	// assignments reuse the snapshot's storage from earlier frames
+	snapshot.bvh = m_bvh;
+	size_t slots = 0;
+	for (int d = 0; d < m_registry.size(); d++)
+		slots = max(slots, (size_t)m_registry.slot(d) + 1);
+	snapshot.mesh.assign(slots, -1);
+	snapshot.world.resize(slots);
+	snapshot.worldBounds.resize(slots);
+	snapshot.material.resize(slots);
+	const TransformHierarchy& transforms = m_registry.transforms();
+	for (int d = 0; d < m_registry.size(); d++)
+	{
+		int slot = m_registry.slot(d);
+		snapshot.mesh[slot] = m_registry.mesh(d);
+		snapshot.world[slot] = transforms.world(m_registry.node(d));
+		snapshot.worldBounds[slot] = m_registry.worldBounds(d);
+		snapshot.material[slot] = m_registry.material(d);
+	}
+	snapshot.meshes.resize(m_registry.meshCount());
+	for (int m = 0; m < m_registry.meshCount(); m++)
+		snapshot.meshes[m] = m_registry.meshGeometry(m);
 }
 
 void Scene::draw()
 {
 	// 1. Send the renderer the current camera transform and the projection
 	// 2. Tell all models to draw themselves
+	snapshot(m_snapshot, m_renderer->GetWidth(), m_renderer->GetHeight());
+	m_renderer->ClearColorBuffer();
+	m_renderer->ClearDepthBuffer();
+	m_sceneRenderer.render(m_snapshot, *m_renderer);
+
+	// models drawing themselves go through the renderer's state, one view at a time
+	const TransformHierarchy& transforms = m_registry.transforms();
+	for (int v = 0; v < m_sceneRenderer.getViewCount() && !m_unbatched.empty(); v++)
+	{
+		const RenderView& view = m_sceneRenderer.getView(v);
+		m_renderer->SetViewport(view.viewport);
+		int cameraIndex = views.empty() ? activeCamera : views[v].camera;
+		if (cameraIndex >= 0 && cameraIndex < (int)cameras.size())
+		{
+			const Camera* camera = cameras[cameraIndex];
+			m_renderer->SetCamera(camera->getTransformation(), camera->getProjection(), view.viewProjection);
+		}
+		for (size_t i = 0; i < m_unbatched.size(); i++)
+		{
+			int d = m_registry.denseOfSlot(m_unbatched[i]);
+			int node = m_registry.node(d);
+			m_renderer->SetObjectMatrices(transforms.world(node), transforms.normal(node));
+			m_registry.facade(d)->draw(m_renderer);
+		}
+	}
+	m_renderer->SetViewport(Viewport(0, 0, m_renderer->GetWidth(), m_renderer->GetHeight()));
 
 	m_renderer->SwapBuffers();
 }
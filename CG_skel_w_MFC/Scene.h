@@ -4,24 +4,86 @@
 #include <vector>
 #include <string>
 #include "Renderer.h"
+#include "ModelRegistry.h"
+#include "BVH.h"
+#include "SceneRenderer.h"
 using namespace std;
 
 class Model {
-protected:
+public:
+	Model() : registry(NULL) {}
 	virtual ~Model() {}
-	void virtual draw()=0;
+	void virtual draw(Renderer* renderer)=0;
+
+	// Set when the model is added to a scene. From then on its transform,
+	// bounds and material live in the scene's registry and this object is
+	// only a facade over them.
+	ModelRegistry* registry;
+	ModelHandle handle;
 };
 
 
+class Scene;
+
+// A light source. Directional lights shine along their direction from far
+// away, point lights from their position in every direction and spot
+// lights from their position along their direction, inside a cone. Point
+// and spot lights reach range world units. Like cameras, lights added to a
+// scene redraw it when they change.
 class Light {
+	LightType type;
+	vec3 position;
+	vec3 direction;
+	vec3 color;
+	float intensity;
+	float range;
+	float innerAngle, outerAngle;	// half angles of the spot cone, degrees
+	int shadowSize;
+
+	void changed();
+
+public:
+	// a white directional light shining down
+	Light() : type(LIGHT_DIRECTIONAL), position(0, 0, 0), direction(0, -1, 0), color(1, 1, 1), intensity(1),
+		range(10), innerAngle(20), outerAngle(30), shadowSize(0), scene(NULL) {}
+	void setDirectional(const vec3& direction);
+	void setPoint(const vec3& position, float range);
+	// the light is full inside innerAngle and fades out towards outerAngle
+	void setSpot(const vec3& position, const vec3& direction, float range, float innerAngle, float outerAngle);
+	void setColor(const vec3& color, float intensity = 1);
+	// Shadows from a size x size shadow map, 0 for none. Directional and
+	// spot lights cast them, point lights don't.
+	void setShadows(int size);
 
+	LightType getType() const { return type; }
+	const vec3& getPosition() const { return position; }
+	const vec3& getDirection() const { return direction; }
+	float getRange() const { return range; }
+	int getShadowSize() const { return shadowSize; }
+
+	// as the renderer's lighting reads it
+	ShadingLight getShadingLight() const;
+
+	Scene* scene;
 };
 
+// cTransform is the view matrix (world to camera). The combined
+// view-projection matrix and its frustum planes are derived from it and the
+// projection, and only recomputed after one of them changed.
 class Camera {
 	mat4 cTransform;
 	mat4 projection;
 
+	mutable mat4 viewProjection;
+	mutable ::Frustum frustum;
+	mutable bool dirty;
+	unsigned version;
+
+	void changed();
+	void refresh() const;
+
 public:
+	Camera() : dirty(true), version(0), scene(NULL) {}
 	void setTransformation(const mat4& transform);
 	void LookAt(const vec4& eye, const vec4& at, const vec4& up );
 	void Ortho( const float left, const float right,
@@ -33,21 +95,95 @@ public:
 	mat4 Perspective( const float fovy, const float aspect,
 		const float zNear, const float zFar);
 
+	const mat4& getTransformation() const { return cTransform; }
+	const mat4& getProjection() const { return projection; }
+	const mat4& getViewProjection() const { if (dirty) refresh(); return viewProjection; }
+	const ::Frustum& getFrustum() const { if (dirty) refresh(); return frustum; }
+	// bumped on every change, lets callers notice a moved camera cheaply
+	unsigned getVersion() const { return version; }
+
+	// Set when the camera is added to a scene, which then redraws whenever
+	// the camera changes.
+	Scene* scene;
 };
 
 class Scene {
 
-	vector<Model*> models;
 	vector<Light*> lights;
+	vec3 m_ambient;
 	vector<Camera*> cameras;
 	Renderer *m_renderer;
+	ModelRegistry m_registry;
+
+	vector<int> m_unbatched;	// slots of models that draw themselves
+
+	// world space bounds of every mesh model, items are registry slots
+	BVH m_bvh;
+
+	// draws for the synchronous draw()
+	SceneSnapshot m_snapshot;
+	SceneRenderer m_sceneRenderer;
+
+	// changes since the last snapshot, DIRTY_ flags
+	unsigned m_dirty;
+	// bumped whenever models are added, removed or moved, see
+	// SceneSnapshot::casterVersion
+	unsigned m_casterVersion;
+	void (*m_redisplay)();
+
+	static void updateBoundsJob(void* data, int begin, int end);
 
 public:
-	Scene() {};
-	Scene(Renderer *renderer) : m_renderer(renderer) {};
+	Scene() : m_ambient(0.1f, 0.1f, 0.1f), m_renderer(NULL), m_dirty(DIRTY_ALL), m_casterVersion(0), m_redisplay(NULL), lodHiddenPixels(0.5f), activeModel(0), activeLight(0), activeCamera(0) {};
+	Scene(Renderer *renderer) : m_ambient(0.1f, 0.1f, 0.1f), m_renderer(renderer), m_dirty(DIRTY_ALL), m_casterVersion(0), m_redisplay(NULL), lodHiddenPixels(0.5f), activeModel(0), activeLight(0), activeCamera(0) {};
+	~Scene();
 	void loadOBJModel(string fileName);
+	void loadOBJModels(const vector<string>& fileNames);
 	void draw();
 	void drawDemo();
+	int addCamera(Camera* camera);
+	int addLight(Light* light);
+	void setAmbient(const vec3& ambient) { m_ambient = ambient; invalidate(DIRTY_LIGHTS); }
+	Camera* getActiveCamera() { return activeCamera >= 0 && activeCamera < (int)cameras.size() ? cameras[activeCamera] : NULL; }
+
+	// Updates the scene and copies what drawing it needs into snapshot, for
+	// drawing elsewhere (see RenderThread). Models that draw themselves are
+	// left out: they are only drawn by draw().
+	void snapshot(SceneSnapshot& snapshot, int width, int height);
+
+	// The scene is only redrawn after it changed. Changes made through its
+	// methods, and through its cameras, mark it dirty; the first one since
+	// the last snapshot calls the redisplay callback, later ones are
+	// coalesced into that same redraw. Call invalidate() yourself after
+	// changing the public fields below.
+	enum { DIRTY_CAMERA = 1, DIRTY_MODELS = 2, DIRTY_TRANSFORMS = 4, DIRTY_VIEWS = 8, DIRTY_LIGHTS = 16, DIRTY_ALL = 31 };
+	void invalidate(unsigned what = DIRTY_ALL);
+	bool isDirty() const { return m_dirty != 0; }
+	unsigned getDirty() const { return m_dirty; }
+	void setRedisplayCallback(void (*redisplay)()) { m_redisplay = redisplay; }
+
+	// Models are addressed by handles. An invalid (default) parent handle
+	// attaches a model to the scene root. The scene owns added models.
+	ModelHandle addModel(Model* model, ModelHandle parent = ModelHandle());
+	void removeModel(ModelHandle model);
+	void setParent(ModelHandle model, ModelHandle parent);
+	void setModelTransform(ModelHandle model, const mat4& transform);
+	const mat4& getModelWorldTransform(ModelHandle model) const;
+	int getModelCount() const { return m_registry.size(); }
+	void update();
+
+	// Places model's geometry once more, sharing its vertex data.
+	// Returns an invalid handle if model has no geometry.
+	ModelHandle instanceModel(ModelHandle model, ModelHandle parent = ModelHandle());
+
+	// models projecting to fewer pixels than this are skipped
+	float lodHiddenPixels;
+
+	// Split view layout. With no views the active camera fills the window.
+	// Views are culled and drawn concurrently, as jobs.
+	vector<SceneView> views;
+	void addView(int camera, float left, float bottom, float width, float height);
+	void clearViews() { views.clear(); invalidate(DIRTY_VIEWS); }
 	
 	int activeModel;
 	int activeLight;
@@ -0,0 +1,250 @@
+#include "StdAfx.h"
+#include "SceneRenderer.h"
+#include "Scene.h"
+#include "JobSystem.h"
+
+using namespace std;
+
+void SceneRenderer::render(const SceneSnapshot& snapshot, Renderer& renderer)
+{
+	m_snapshot = &snapshot;
+	m_renderer = &renderer;
+	updateShadows();
+	renderer.SetLights(m_lights.empty() ? NULL : &m_lights[0], (int)m_lights.size(), snapshot.ambient,
+		m_shadowMaps.empty() ? NULL : &m_shadowMaps[0], (int)m_shadowMaps.size());
+	setupViews();
+
+	// world space data is shared, each view only culls and records its draws
+	JobSystem& jobs = JobSystem::instance();
+	JobCounter viewsDone;
+	jobs.parallelFor(drawViewJob, this, (int)m_viewStates.size(), 1, viewsDone);
+	jobs.wait(viewsDone);
+}
+
+// Whether a shadow map drawn for light a still holds for light b.
+static bool SameShadowView(const ShadingLight& a, const ShadingLight& b)
+{
+	if (a.type != b.type)
+		return false;
+	for (int k = 0; k < 3; k++)
+		if (a.direction[k] != b.direction[k] || (a.type != LIGHT_DIRECTIONAL && a.position[k] != b.position[k]))
+			return false;
+	return a.type == LIGHT_DIRECTIONAL || (a.range == b.range && a.cosOuter == b.cosOuter);
+}
+
+void SceneRenderer::updateShadows()
+{
+	// shadow maps are only drawn again when their light or the casters
+	// moved, drawing them every frame would cost more than the frame
+	const SceneSnapshot& snapshot = *m_snapshot;
+	m_lights = snapshot.lights;
+	m_shadowMaps.clear();
+	m_shadowMapsDrawn = 0;
+	if (m_shadowCaches.size() != m_lights.size())
+	{
+		m_shadowCaches.clear();
+		m_shadowCaches.resize(m_lights.size());
+	}
+	for (size_t i = 0; i < m_lights.size(); i++)
+	{
+		ShadowCache& cache = m_shadowCaches[i];
+		int size = i < snapshot.shadowSizes.size() ? snapshot.shadowSizes[i] : 0;
+		if (size <= 0 || m_lights[i].type == LIGHT_POINT)
+		{
+			cache.valid = false;
+			continue;
+		}
+		if (!cache.valid || cache.map.size != size || cache.casterVersion != snapshot.casterVersion ||
+			!SameShadowView(cache.light, m_lights[i]))
+		{
+			drawShadowMap(m_lights[i], size, cache);
+			m_shadowMapsDrawn++;
+		}
+		m_lights[i].shadow = (int)m_shadowMaps.size();
+		m_shadowMaps.push_back(cache.map);
+	}
+}
+
+// Draws the light's shadow map: directional lights look down the light over
+// the bounds of every model, so the map holds for any camera; spot lights
+// through their cone, out to their range.
+void SceneRenderer::drawShadowMap(const ShadingLight& light, int size, ShadowCache& cache)
+{
+	const SceneSnapshot& snapshot = *m_snapshot;
+	vec3 direction(light.direction[0], light.direction[1], light.direction[2]);
+	// any up vector not along the light
+	vec4 up = fabs(direction.y) < 0.99f ? vec4(0, 1, 0, 0) : vec4(1, 0, 0, 0);
+	Camera camera;
+	float texel;	// world size of a texel at w = 1
+	if (light.type == LIGHT_DIRECTIONAL)
+	{
+		AABB bounds;
+		for (size_t slot = 0; slot < snapshot.mesh.size(); slot++)
+			if (snapshot.mesh[slot] >= 0)
+				bounds.expand(snapshot.worldBounds[slot]);
+		vec3 center = bounds.isEmpty() ? vec3(0, 0, 0) : bounds.center();
+		float radius = bounds.isEmpty() ? 1 : (max)(length(bounds.extent()), 1e-3f) * 1.01f;
+		vec3 eye = center - direction * radius;
+		camera.LookAt(vec4(eye.x, eye.y, eye.z, 1), vec4(center.x, center.y, center.z, 1), up);
+		camera.Ortho(-radius, radius, -radius, radius, 0, 2 * radius);
+		texel = 2 * radius / size;
+	}
+	else
+	{
+		vec3 eye(light.position[0], light.position[1], light.position[2]);
+		vec3 at = eye + direction;
+		float fovy = (min)(2 * acos(light.cosOuter) * 180.0f / (float)M_PI, 170.0f);
+		camera.LookAt(vec4(eye.x, eye.y, eye.z, 1), vec4(at.x, at.y, at.z, 1), up);
+		camera.Perspective(fovy, 1, light.range * 0.01f, light.range);
+		texel = 2 * tan(fovy * 0.5f * (float)M_PI / 180.0f) / size;
+	}
+
+	ViewState& state = m_shadowView;
+	state.view.viewport = Viewport(0, 0, size, size);
+	state.view.viewProjection = camera.getViewProjection();
+	state.view.eye = EyePosition(camera.getTransformation());
+	state.frustum = camera.getFrustum();
+	state.visible.clear();
+	snapshot.bvh.cull(state.frustum, state.visible, state.cullStack);
+	cache.depth.resize(size * size);
+	m_renderer->BeginShadowMap(&cache.depth[0], size);
+	drawBatches(state);
+	m_renderer->EndShadowMap();
+
+	// clip space to the map's texels and [0,1] depth
+	const mat4& m = state.view.viewProjection;
+	for (int c = 0; c < 4; c++)
+	{
+		cache.map.matrix[0][c] = (m[0][c] + m[3][c]) * 0.5f * size;
+		cache.map.matrix[1][c] = (m[1][c] + m[3][c]) * 0.5f * size;
+		cache.map.matrix[2][c] = (m[2][c] + m[3][c]) * 0.5f;
+		cache.map.matrix[3][c] = m[3][c];
+	}
+	cache.map.depth = &cache.depth[0];
+	cache.map.size = size;
+	cache.map.normalOffset = texel;
+	// half a texel's depth for directional lights; perspective maps spend
+	// their depth near the light, the normal offset does without there
+	cache.map.bias = light.type == LIGHT_DIRECTIONAL ? 0.5f / size : 0;
+	cache.light = light;
+	cache.casterVersion = snapshot.casterVersion;
+	cache.valid = true;
+}
+
+void SceneRenderer::setupViews()
+{
+	const SceneSnapshot& snapshot = *m_snapshot;
+	int width = m_renderer->GetWidth(), height = m_renderer->GetHeight();
+	size_t count = snapshot.views.empty() ? 1 : snapshot.views.size();
+	m_viewStates.resize(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		ViewState& state = m_viewStates[i];
+		int cameraIndex = snapshot.activeCamera;
+		if (snapshot.views.empty())
+			state.view.viewport = Viewport(0, 0, width, height);
+		else
+		{
+			const SceneView& v = snapshot.views[i];
+			cameraIndex = v.camera;
+			int x0 = (int)(v.left * width + 0.5f), y0 = (int)(v.bottom * height + 0.5f);
+			int x1 = (int)((v.left + v.width) * width + 0.5f), y1 = (int)((v.bottom + v.height) * height + 0.5f);
+			state.view.viewport = Viewport(x0, y0, x1 - x0, y1 - y0);
+		}
+
+		state.hasCamera = cameraIndex >= 0 && cameraIndex < (int)snapshot.cameras.size();
+		if (state.hasCamera)
+		{
+			const CameraState& camera = snapshot.cameras[cameraIndex];
+			state.view.viewProjection = camera.viewProjection;
+			state.view.eye = EyePosition(camera.view);
+			state.frustum = camera.frustum;
+			state.projectionScale = camera.projection[1][1];
+		}
+		else
+		{
+			state.view.viewProjection = mat4();
+			state.view.eye = vec3(0, 0, 0);
+		}
+	}
+}
+
+void SceneRenderer::drawViewJob(void* data, int begin, int end)
+{
+	SceneRenderer* self = (SceneRenderer*)data;
+	for (int i = begin; i < end; i++)
+		self->drawView(self->m_viewStates[i]);
+}
+
+void SceneRenderer::drawView(ViewState& state)
+{
+	const SceneSnapshot& snapshot = *m_snapshot;
+	state.visible.clear();
+	if (state.hasCamera)
+	{
+		snapshot.bvh.cull(state.frustum, state.visible, state.cullStack);
+		updateLod(state);
+	}
+	else
+	{
+		// no camera, the renderer's default view shows everything
+		for (int slot = 0; slot < (int)snapshot.mesh.size(); slot++)
+			if (snapshot.mesh[slot] >= 0)
+				state.visible.push_back(slot);
+	}
+	drawBatches(state);
+}
+
+void SceneRenderer::updateLod(ViewState& state)
+{
+	// projected size of each visible model's bounding sphere, in pixels;
+	// models below the threshold are dropped from the view's list
+	const SceneSnapshot& snapshot = *m_snapshot;
+	const vec4& wRow = state.view.viewProjection[3];
+	float halfHeight = 0.5f * state.view.viewport.height;
+	float hidden = snapshot.lodHiddenPixels;
+	size_t kept = 0;
+	for (size_t i = 0; i < state.visible.size(); i++)
+	{
+		int slot = state.visible[i];
+		const AABB& bounds = snapshot.worldBounds[slot];
+		vec3 c = bounds.center();
+		float w = wRow.x*c.x + wRow.y*c.y + wRow.z*c.z + wRow.w;
+		float pixels = w > 1e-6f ? length(bounds.extent()) * fabs(state.projectionScale) * halfHeight / w : hidden;
+		if (pixels >= hidden)
+			state.visible[kept++] = slot;
+	}
+	state.visible.resize(kept);
+}
+
+void SceneRenderer::drawBatches(ViewState& state)
+{
+	const SceneSnapshot& snapshot = *m_snapshot;
+	vector<InstanceBatch>& batches = state.batches;
+	batches.resize(snapshot.meshes.size());
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		batches[b].transforms.clear();
+		batches[b].materials.clear();
+	}
+	for (size_t i = 0; i < state.visible.size(); i++)
+	{
+		int slot = state.visible[i];
+		if (snapshot.mesh[slot] < 0)
+			continue;
+		InstanceBatch& batch = batches[snapshot.mesh[slot]];
+		batch.transforms.push_back(snapshot.world[slot]);
+		batch.materials.push_back(snapshot.material[slot]);
+	}
+
+	// one instanced call per shared geometry
+	for (size_t b = 0; b < batches.size(); b++)
+	{
+		const InstanceBatch& batch = batches[b];
+		if (batch.transforms.empty())
+			continue;
+		const MeshGeometry& geometry = *snapshot.meshes[b];
+		m_renderer->DrawTrianglesInstanced(state.view, &geometry.vertex_positions, &geometry.vertex_normals,
+			&batch.transforms[0], &batch.materials[0], (int)batch.transforms.size());
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+#include <vector>
+#include "Renderer.h"
+#include "MeshGeometry.h"
+#include "Bounds.h"
+#include "BVH.h"
+
+using namespace std;
+
+// Visible instances of one mesh in the current frame, drawn with a single
+// instanced call. Reused between frames.
+struct InstanceBatch {
+	vector<mat4> transforms;
+	vector<Material> materials;
+};
+
+// One camera drawn into part of the frame. The rectangle is in fractions of
+// the window, origin at the bottom left.
+struct SceneView {
+	int camera;
+	float left, bottom, width, height;
+};
+
+// Camera matrices as of the snapshot.
+struct CameraState {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	::Frustum frustum;
+};
+
+// Everything needed to draw a frame of the scene, copied out of it. A
+// snapshot owns references to its meshes and shares nothing mutable with
+// the scene, so it can be drawn on another thread while the scene changes.
+// Per model arrays are indexed by registry slot, as are the BVH's items.
+struct SceneSnapshot {
+	int width, height;		// frame size to draw at
+	float resolutionScale;		// fraction of it actually drawn, see Renderer::SetResolutionScale
+	float frameBudget;		// ms, see Renderer::SetFrameBudget
+	vector<CameraState> cameras;
+	vector<ShadingLight> lights;	// world space
+	vector<int> shadowSizes;	// per light, 0 for no shadows
+	vec3 ambient;
+	vector<SceneView> views;	// empty: activeCamera fills the frame
+	int activeCamera;
+	float lodHiddenPixels;
+
+	BVH bvh;
+	vector<int> mesh;		// -1 for free slots and models drawing themselves
+	vector<mat4> world;
+	vector<AABB> worldBounds;
+	vector<Material> material;
+	vector<MeshGeometryPtr> meshes;	// by mesh id
+	unsigned casterVersion;		// changes whenever models were added, removed or moved
+
+	SceneSnapshot() : width(0), height(0), resolutionScale(1.0f), frameBudget(0), activeCamera(0), lodHiddenPixels(0.5f),
+		casterVersion(0) {}
+};
+
+// Draws snapshots: culls every view against the BVH, drops models too small
+// to see, batches instances by mesh and records the draws. Views are
+// processed concurrently, as jobs. Keeps its scratch between frames, and
+// the lights' shadow maps until the light or the models move.
+class SceneRenderer
+{
+	struct ViewState {
+		RenderView view;
+		::Frustum frustum;
+		bool hasCamera;
+		float projectionScale;
+		vector<int> visible;	// slots, this frame
+		vector<int> cullStack;
+		vector<InstanceBatch> batches;	// by mesh id
+	};
+	vector<ViewState> m_viewStates;
+	const SceneSnapshot* m_snapshot;
+	Renderer* m_renderer;
+
+	// A light's shadow map and what it was drawn for: the light as it was
+	// and the snapshot's caster version.
+	struct ShadowCache {
+		vector<float> depth;
+		ShadowMap map;
+		ShadingLight light;
+		unsigned casterVersion;
+		bool valid;
+
+		ShadowCache() : valid(false) {}
+	};
+	vector<ShadowCache> m_shadowCaches;	// per light
+	ViewState m_shadowView;		// of the map being drawn
+	vector<ShadingLight> m_lights;	// the snapshot's, with their shadow maps
+	vector<ShadowMap> m_shadowMaps;
+	int m_shadowMapsDrawn;
+
+	void updateShadows();
+	void drawShadowMap(const ShadingLight& light, int size, ShadowCache& cache);
+	void setupViews();
+	void drawView(ViewState& state);
+	static void drawViewJob(void* data, int begin, int end);
+	void updateLod(ViewState& state);
+	void drawBatches(ViewState& state);
+
+public:
+	SceneRenderer() : m_snapshot(NULL), m_renderer(NULL), m_shadowMapsDrawn(0) {}
+
+	// Records the snapshot's draws. The caller clears and flushes.
+	void render(const SceneSnapshot& snapshot, Renderer& renderer);
+
+	// views of the last render(), in snapshot order
+	int getViewCount() const { return (int)m_viewStates.size(); }
+	const RenderView& getView(int i) const { return m_viewStates[i].view; }
+	// shadow maps the last render() had to draw again
+	int getShadowMapsDrawn() const { return m_shadowMapsDrawn; }
+};
@@ -0,0 +1,184 @@
+#include "StdAfx.h"
+#include "TransformHierarchy.h"
+#include "JobSystem.h"
+#include <algorithm>
+
+using namespace std;
+
+TransformHierarchy::TransformHierarchy()
+{
+}
+
+int TransformHierarchy::createNode(int parent)
+{
+	int node;
+	if (!m_free.empty())
+	{
+		node = m_free.back();
+		m_free.pop_back();
+		m_local[node] = mat4();
+		m_world[node] = mat4();
+		m_normal[node] = mat3();
+		m_alive[node] = 1;
+	}
+	else
+	{
+		node = (int)m_local.size();
+		m_local.push_back(mat4());
+		m_world.push_back(mat4());
+		m_normal.push_back(mat3());
+		m_parent.push_back(NO_PARENT);
+		m_firstChild.push_back(NO_PARENT);
+		m_nextSibling.push_back(NO_PARENT);
+		m_dirty.push_back(0);
+		m_alive.push_back(1);
+	}
+	m_parent[node] = NO_PARENT;
+	m_firstChild[node] = NO_PARENT;
+	m_nextSibling[node] = NO_PARENT;
+	m_dirty[node] = 0;
+	link(node, parent);
+	markDirty(node);
+	return node;
+}
+
+void TransformHierarchy::destroyNode(int node)
+{
+	unlink(node);
+	m_stack.clear();
+	m_stack.push_back(node);
+	while (!m_stack.empty())
+	{
+		int n = m_stack.back();
+		m_stack.pop_back();
+		for (int c = m_firstChild[n]; c != NO_PARENT; c = m_nextSibling[c])
+			m_stack.push_back(c);
+		m_alive[n] = 0;
+		m_dirty[n] = 0;
+		m_parent[n] = m_firstChild[n] = m_nextSibling[n] = NO_PARENT;
+		m_free.push_back(n);
+	}
+}
+
+void TransformHierarchy::setParent(int node, int parent)
+{
+	// refuse to make a node its own ancestor
+	for (int p = parent; p != NO_PARENT; p = m_parent[p])
+		if (p == node)
+			return;
+
+	unlink(node);
+	link(node, parent);
+	markDirty(node);
+}
+
+void TransformHierarchy::setLocal(int node, const mat4& local)
+{
+	m_local[node] = local;
+	markDirty(node);
+}
+
+// below this many nodes the update isn't worth spreading over jobs
+#define PARALLEL_MIN_NODES 256
+
+void TransformHierarchy::update()
+{
+	m_updated.clear();
+	m_subtrees.clear();
+	for (size_t i = 0; i < m_dirtyList.size(); i++)
+	{
+		int node = m_dirtyList[i];
+		// already handled as part of an earlier subtree, or destroyed
+		if (!m_alive[node] || !m_dirty[node])
+			continue;
+		// a dirty ancestor will reach this node from above
+		if (hasDirtyAncestor(node))
+			continue;
+		m_subtrees.push_back((int)m_updated.size());
+		collectSubtree(node);
+	}
+	m_dirtyList.clear();
+	int subtrees = (int)m_subtrees.size();
+	m_subtrees.push_back((int)m_updated.size());
+
+	// each subtree is listed parents first and touches no other subtree
+	if (m_updated.size() < PARALLEL_MIN_NODES)
+	{
+		updateJob(this, 0, subtrees);
+		return;
+	}
+	JobSystem& jobs = JobSystem::instance();
+	JobCounter done;
+	jobs.parallelFor(updateJob, this, subtrees, (max)(1, subtrees / (4 * (jobs.getWorkerCount() + 1))), done);
+	jobs.wait(done);
+}
+
+void TransformHierarchy::markDirty(int node)
+{
+	if (m_dirty[node])
+		return;
+	m_dirty[node] = 1;
+	m_dirtyList.push_back(node);
+}
+
+void TransformHierarchy::link(int node, int parent)
+{
+	m_parent[node] = parent;
+	if (parent == NO_PARENT)
+		return;
+	m_nextSibling[node] = m_firstChild[parent];
+	m_firstChild[parent] = node;
+}
+
+void TransformHierarchy::unlink(int node)
+{
+	int parent = m_parent[node];
+	if (parent != NO_PARENT)
+	{
+		int* link = &m_firstChild[parent];
+		while (*link != node)
+			link = &m_nextSibling[*link];
+		*link = m_nextSibling[node];
+	}
+	m_parent[node] = NO_PARENT;
+	m_nextSibling[node] = NO_PARENT;
+}
+
+bool TransformHierarchy::hasDirtyAncestor(int node) const
+{
+	for (int p = m_parent[node]; p != NO_PARENT; p = m_parent[p])
+		if (m_dirty[p])
+			return true;
+	return false;
+}
+
+void TransformHierarchy::collectSubtree(int root)
+{
+	m_stack.clear();
+	m_stack.push_back(root);
+	while (!m_stack.empty())
+	{
+		int node = m_stack.back();
+		m_stack.pop_back();
+		m_dirty[node] = 0;
+		m_updated.push_back(node);
+		for (int c = m_firstChild[node]; c != NO_PARENT; c = m_nextSibling[c])
+			m_stack.push_back(c);
+	}
+}
+
+void TransformHierarchy::updateJob(void* data, int begin, int end)
+{
+	TransformHierarchy* self = (TransformHierarchy*)data;
+	int first = self->m_subtrees[begin], last = self->m_subtrees[end];
+	for (int i = first; i < last; i++)
+	{
+		int node = self->m_updated[i];
+		int parent = self->m_parent[node];
+		if (parent == NO_PARENT)
+			self->m_world[node] = self->m_local[node];
+		else
+			self->m_world[node] = self->m_world[parent] * self->m_local[node];
+		self->m_normal[node] = NormalMatrix(self->m_world[node]);
+	}
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include "vec.h"
+#include "mat.h"
+
+using namespace std;
+
+// Parent/child transform tree with cached world and normal matrices.
+//
+// Nodes are ids into dense arrays. setLocal() only records the node as dirty;
+// update() then recomputes the world matrices of the dirty subtrees, parents
+// before children. Nodes whose transforms did not change are not visited.
+// Separate dirty subtrees are computed concurrently on the job system.
+class TransformHierarchy
+{
+	vector<mat4> m_local;
+	vector<mat4> m_world;
+	vector<mat3> m_normal;
+	vector<int> m_parent;
+	vector<int> m_firstChild;
+	vector<int> m_nextSibling;
+	vector<char> m_dirty;
+	vector<char> m_alive;
+
+	vector<int> m_free;		// recycled ids
+	vector<int> m_dirtyList;	// nodes whose local (or parent) changed
+	vector<int> m_stack;		// scratch for subtree walks
+	vector<int> m_updated;		// nodes recomputed by the last update()
+	vector<int> m_subtrees;		// start of each dirty subtree in m_updated
+
+	void markDirty(int node);
+	void link(int node, int parent);
+	void unlink(int node);
+	bool hasDirtyAncestor(int node) const;
+	void collectSubtree(int root);
+	static void updateJob(void* data, int begin, int end);
+
+public:
+	enum { NO_PARENT = -1 };
+
+	TransformHierarchy();
+
+	int createNode(int parent = NO_PARENT);
+	void destroyNode(int node);	// also destroys the node's subtree
+	void setParent(int node, int parent);
+	void setLocal(int node, const mat4& local);
+	void update();
+
+	int parent(int node) const { return m_parent[node]; }
+	int firstChild(int node) const { return m_firstChild[node]; }
+	int nextSibling(int node) const { return m_nextSibling[node]; }
+	const mat4& local(int node) const { return m_local[node]; }
+	const mat4& world(int node) const { return m_world[node]; }
+	const mat3& normal(int node) const { return m_normal[node]; }
+	bool isDirty(int node) const { return m_dirty[node] != 0; }
+
+	// nodes whose world matrices the last update() recomputed
+	const vector<int>& updatedNodes() const { return m_updated; }
+	int lastUpdateCount() const { return (int)m_updated.size(); }
+};
@@ -0,0 +1,46 @@
+#pragma once
+#include <atomic>
+
+using namespace std;
+
+// Hands a stream of values from one writer thread to one reader thread
+// without locks. The writer fills back() and publish()es it; the reader
+// calls consume() to take the latest published value as front(). Each side
+// owns its buffer exclusively, the third one sits in between, and the two
+// sides only ever exchange indices with it atomically. Neither side waits:
+// values the reader never picked up are simply overwritten.
+template<class T>
+class TripleBuffer
+{
+	enum { INDEX_MASK = 3, FRESH = 4 };
+
+	T m_buffers[3];
+	int m_back;		// writer's
+	int m_front;		// reader's
+	atomic<int> m_middle;	// index, FRESH once published and not yet consumed
+
+	TripleBuffer(const TripleBuffer&);
+	TripleBuffer& operator=(const TripleBuffer&);
+
+public:
+	TripleBuffer() : m_back(0), m_front(1), m_middle(2) {}
+
+	T& back() { return m_buffers[m_back]; }
+	void publish() { m_back = m_middle.exchange(m_back | FRESH) & INDEX_MASK; }
+
+	bool hasFresh() const { return (m_middle.load() & FRESH) != 0; }
+	// Returns false, keeping the current front, if nothing new was published.
+	bool consume()
+	{
+		if (!hasFresh())
+			return false;
+		m_front = m_middle.exchange(m_front) & INDEX_MASK;
+		return true;
+	}
+	T& front() { return m_buffers[m_front]; }
+	const T& front() const { return m_buffers[m_front]; }
+
+	// all three, for setup and statistics; not while both sides are running
+	T& buffer(int i) { return m_buffers[i]; }
+	const T& buffer(int i) const { return m_buffers[i]; }
+};
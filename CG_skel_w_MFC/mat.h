@@ -278,9 +278,9 @@ class mat3 {
     //
 
     vec3 operator * ( const vec3& v ) const {  // m * v
-	return vec3( 0,
-		     0, /*BUG*/
-		     0 );
+	return vec3( _m[0][0]*v.x + _m[0][1]*v.y + _m[0][2]*v.z,
+		     _m[1][0]*v.x + _m[1][1]*v.y + _m[1][2]*v.z,
+		     _m[2][0]*v.x + _m[2][1]*v.y + _m[2][2]*v.z );
     }
 	
     //
@@ -321,7 +321,9 @@ mat3 matrixCompMult( const mat3& A, const mat3& B ) {
 
 inline
 mat3 transpose( const mat3& A ) {
-    return mat3( 0,0,0,0,0,0,0,0,0); /*BUG*/
+    return mat3( A[0][0], A[0][1], A[0][2],
+		 A[1][0], A[1][1], A[1][2],
+		 A[2][0], A[2][1], A[2][2] );
 }
 
 //----------------------------------------------------------------------------
@@ -548,6 +550,30 @@ mat4 RotateX( const GLfloat theta )
     return c;
 }
 
+inline
+mat4 RotateY( const GLfloat theta )
+{
+    GLfloat angle = (M_PI/180.0) * theta;
+
+    mat4 c;
+    c[2][2] = c[0][0] = cos(angle);
+    c[0][2] = sin(angle);
+    c[2][0] = -c[0][2];
+    return c;
+}
+
+inline
+mat4 RotateZ( const GLfloat theta )
+{
+    GLfloat angle = (M_PI/180.0) * theta;
+
+    mat4 c;
+    c[0][0] = c[1][1] = cos(angle);
+    c[1][0] = sin(angle);
+    c[0][1] = -c[1][0];
+    return c;
+}
+
 
 //----------------------------------------------------------------------------
 //
@@ -558,9 +584,9 @@ inline
 mat4 Translate( const GLfloat x, const GLfloat y, const GLfloat z )
 {
     mat4 c;
-    c[0][0] = x;
-    c[0][0] = y;  /*BUG*/
-    c[0][0] = z;
+    c[0][3] = x;
+    c[1][3] = y;
+    c[2][3] = z;
     return c;
 }
 
@@ -586,8 +612,8 @@ mat4 Scale( const GLfloat x, const GLfloat y, const GLfloat z )
 {
     mat4 c;
     c[0][0] = x;
-    c[0][0] = y; /*BUG*/
-    c[0][0] = z;
+    c[1][1] = y;
+    c[2][2] = z;
     return c;
 }
 
@@ -598,3 +624,77 @@ mat4 Scale( const vec3& v )
 }
 
 //----------------------------------------------------------------------------
+//
+//  Normal matrix generator - inverse transpose of the upper 3x3 of m
+//
+
+inline
+mat3 NormalMatrix( const mat4& m )
+{
+    const vec4& a = m[0];
+    const vec4& b = m[1];
+    const vec4& c = m[2];
+
+    // rows of the cofactor matrix, which is det * inverse transpose
+    vec3 r0( b.y*c.z - b.z*c.y, b.z*c.x - b.x*c.z, b.x*c.y - b.y*c.x );
+    vec3 r1( c.y*a.z - c.z*a.y, c.z*a.x - c.x*a.z, c.x*a.y - c.y*a.x );
+    vec3 r2( a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x );
+
+    GLfloat det = a.x*r0.x + a.y*r0.y + a.z*r0.z;
+    if ( std::fabs( det ) < 1e-12f )
+	return mat3( r0, r1, r2 );
+
+    GLfloat r = GLfloat(1.0) / det;
+    return mat3( r0 * r, r1 * r, r2 * r );
+}
+
+//----------------------------------------------------------------------------
+//
+//  Inverse of a general 4x4 matrix, by cofactors. Sums are taken in double:
+//  a perspective projection with a close near plane is badly conditioned.
+//  A singular matrix gives the adjugate.
+//
+
+inline
+mat4 Inverse( const mat4& m )
+{
+    double a[4][4];
+    for ( int i = 0; i < 4; i++ )
+	for ( int j = 0; j < 4; j++ )
+	    a[i][j] = m[i][j];
+
+    // 2x2 determinants of the top two rows (s) and the bottom two (c)
+    double s0 = a[0][0]*a[1][1] - a[1][0]*a[0][1];
+    double s1 = a[0][0]*a[1][2] - a[1][0]*a[0][2];
+    double s2 = a[0][0]*a[1][3] - a[1][0]*a[0][3];
+    double s3 = a[0][1]*a[1][2] - a[1][1]*a[0][2];
+    double s4 = a[0][1]*a[1][3] - a[1][1]*a[0][3];
+    double s5 = a[0][2]*a[1][3] - a[1][2]*a[0][3];
+    double c5 = a[2][2]*a[3][3] - a[3][2]*a[2][3];
+    double c4 = a[2][1]*a[3][3] - a[3][1]*a[2][3];
+    double c3 = a[2][1]*a[3][2] - a[3][1]*a[2][2];
+    double c2 = a[2][0]*a[3][3] - a[3][0]*a[2][3];
+    double c1 = a[2][0]*a[3][2] - a[3][0]*a[2][2];
+    double c0 = a[2][0]*a[3][1] - a[3][0]*a[2][1];
+
+    double det = s0*c5 - s1*c4 + s2*c3 + s3*c2 - s4*c1 + s5*c0;
+    double r = std::fabs( det ) < 1e-300 ? 1.0 : 1.0 / det;
+
+    const double b[4][4] = {
+	{  a[1][1]*c5 - a[1][2]*c4 + a[1][3]*c3, -a[0][1]*c5 + a[0][2]*c4 - a[0][3]*c3,
+	   a[3][1]*s5 - a[3][2]*s4 + a[3][3]*s3, -a[2][1]*s5 + a[2][2]*s4 - a[2][3]*s3 },
+	{ -a[1][0]*c5 + a[1][2]*c2 - a[1][3]*c1,  a[0][0]*c5 - a[0][2]*c2 + a[0][3]*c1,
+	  -a[3][0]*s5 + a[3][2]*s2 - a[3][3]*s1,  a[2][0]*s5 - a[2][2]*s2 + a[2][3]*s1 },
+	{  a[1][0]*c4 - a[1][1]*c2 + a[1][3]*c0, -a[0][0]*c4 + a[0][1]*c2 - a[0][3]*c0,
+	   a[3][0]*s4 - a[3][1]*s2 + a[3][3]*s0, -a[2][0]*s4 + a[2][1]*s2 - a[2][3]*s0 },
+	{ -a[1][0]*c3 + a[1][1]*c1 - a[1][2]*c0,  a[0][0]*c3 - a[0][1]*c1 + a[0][2]*c0,
+	  -a[3][0]*s3 + a[3][1]*s1 - a[3][2]*s0,  a[2][0]*s3 - a[2][1]*s1 + a[2][2]*s0 } };
+
+    mat4 inverse;
+    for ( int i = 0; i < 4; i++ )
+	for ( int j = 0; j < 4; j++ )
+	    inverse[i][j] = GLfloat( b[i][j] * r );
+    return inverse;
+}
+
+//----------------------------------------------------------------------------
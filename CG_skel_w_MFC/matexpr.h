@@ -0,0 +1,168 @@
+//////////////////////////////////////////////////////////////////////////////
+//
+//  --- matexpr.h ---
+//
+//  Opt-in expression templates for mat4 / vec4 chains.
+//
+//  A chain started with lazy() is not evaluated until it is converted to a
+//  mat4 or applied to a vec4:
+//
+//	mat4 mvp = lazy(projection) * view * world;   // one pass, no mat4 temps
+//	vec4 p   = lazy(projection) * view * world * v; // three mat-vec products
+//
+//  Converting to mat4 produces the result row by row, pushing each row
+//  through the whole chain, so no intermediate product is formed; the rows
+//  are gathered in one 16 float local so the target may be an operand.
+//  Applying to a vec4 walks the chain right to left, which never forms the
+//  matrix product at all.
+//
+//  The expression keeps references to its operands; evaluate it within the
+//  full expression that built it.
+//
+//////////////////////////////////////////////////////////////////////////////
+
+#pragma once
+#include "mat.h"
+
+//----------------------------------------------------------------------------
+//
+//  MatRef - leaf of a chain, a reference to a concrete mat4
+//
+
+struct MatRef {
+
+    const GLfloat* _m;  // row major, as laid out by mat4
+
+    explicit MatRef( const mat4& m ) : _m( m ) {}
+
+    void row( int i, GLfloat out[4] ) const {
+	const GLfloat* r = _m + 4*i;
+	out[0] = r[0];  out[1] = r[1];  out[2] = r[2];  out[3] = r[3];
+    }
+
+    void apply( const GLfloat in[4], GLfloat out[4] ) const {
+	for ( int i = 0; i < 4; ++i ) {
+	    const GLfloat* r = _m + 4*i;
+	    out[i] = r[0]*in[0] + r[1]*in[1] + r[2]*in[2] + r[3]*in[3];
+	}
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  MatProd - lhs * rhs, where lhs is any expression and rhs a concrete mat4.
+//  Chains are left associative, so the right hand side is always a leaf.
+//
+
+template <class L>
+struct MatProd {
+
+    L               _lhs;
+    const GLfloat*  _rhs;
+
+    MatProd( const L& lhs, const mat4& rhs ) : _lhs( lhs ), _rhs( rhs ) {}
+
+    void row( int i, GLfloat out[4] ) const {
+	GLfloat a[4];
+	_lhs.row( i, a );
+	const GLfloat* b = _rhs;
+	out[0] = a[0]*b[0] + a[1]*b[4] + a[2]*b[8]  + a[3]*b[12];
+	out[1] = a[0]*b[1] + a[1]*b[5] + a[2]*b[9]  + a[3]*b[13];
+	out[2] = a[0]*b[2] + a[1]*b[6] + a[2]*b[10] + a[3]*b[14];
+	out[3] = a[0]*b[3] + a[1]*b[7] + a[2]*b[11] + a[3]*b[15];
+    }
+
+    void apply( const GLfloat in[4], GLfloat out[4] ) const {
+	GLfloat t[4];
+	for ( int i = 0; i < 4; ++i ) {
+	    const GLfloat* r = _rhs + 4*i;
+	    t[i] = r[0]*in[0] + r[1]*in[1] + r[2]*in[2] + r[3]*in[3];
+	}
+	_lhs.apply( t, out );
+    }
+
+    //
+    //  --- Chaining ---
+    //
+
+    MatProd< MatProd<L> > operator * ( const mat4& m ) const
+	{ return MatProd< MatProd<L> >( *this, m ); }
+
+    vec4 operator * ( const vec4& v ) const {
+	vec4 r;
+	apply( v, r );
+	return r;
+    }
+
+    //
+    //  --- Evaluation ---
+    //
+
+    // dst may be one of the operands, so the rows go through a local first
+    void eval( mat4& dst ) const {
+	GLfloat t[16];
+	for ( int i = 0; i < 4; ++i )
+	    row( i, t + 4*i );
+	GLfloat* d = dst;
+	for ( int i = 0; i < 16; ++i )
+	    d[i] = t[i];
+    }
+
+    operator mat4 () const {
+	mat4 r;
+	eval( r );
+	return r;
+    }
+};
+
+//----------------------------------------------------------------------------
+//
+//  lazy() - start a chain.  lazy(a) * b is the first product node.
+//
+
+struct MatLazy {
+
+    MatRef  _ref;
+
+    explicit MatLazy( const mat4& m ) : _ref( m ) {}
+
+    MatProd<MatRef> operator * ( const mat4& m ) const
+	{ return MatProd<MatRef>( _ref, m ); }
+
+    vec4 operator * ( const vec4& v ) const {
+	vec4 r;
+	_ref.apply( v, r );
+	return r;
+    }
+};
+
+inline
+MatLazy lazy( const mat4& m )
+{
+    return MatLazy( m );
+}
+
+//----------------------------------------------------------------------------
+//
+//  Batched transform of n points by an expression.  The chain is folded
+//  into one matrix first, since that is cheaper as soon as n > 1.
+//
+
+template <class L>
+inline
+void transformPoints( const MatProd<L>& e, const vec4* in, vec4* out, int n )
+{
+    GLfloat m[16];
+    for ( int i = 0; i < 4; ++i )
+	e.row( i, m + 4*i );
+
+    for ( int k = 0; k < n; ++k ) {
+	const vec4& v = in[k];
+	out[k] = vec4( m[0]*v.x  + m[1]*v.y  + m[2]*v.z  + m[3]*v.w,
+		       m[4]*v.x  + m[5]*v.y  + m[6]*v.z  + m[7]*v.w,
+		       m[8]*v.x  + m[9]*v.y  + m[10]*v.z + m[11]*v.w,
+		       m[12]*v.x + m[13]*v.y + m[14]*v.z + m[15]*v.w );
+    }
+}
+
+//----------------------------------------------------------------------------
@@ -0,0 +1,60 @@
+// BenchUtil.h : timing and JSON reporting shared by the bench/ programs.
+//
+
+#pragma once
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+typedef std::chrono::steady_clock BenchClock;
+
+inline double elapsedNs(BenchClock::time_point start)
+{
+	return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(BenchClock::now() - start).count();
+}
+
+// keeps the optimizer from dropping the measured work
+extern volatile float g_sink;
+
+struct BenchResult
+{
+	std::string name;
+	std::string form;	// "scalar" or "batched", "specialized" or "generic"
+	double ops;
+	double ns;
+};
+
+// Collects results and prints them as one JSON document on stdout.
+class BenchReport
+{
+	std::string m_suite;
+	std::vector<BenchResult> m_results;
+
+public:
+	BenchReport(const char* suite) : m_suite(suite) {}
+
+	void add(const char* name, const char* form, double ops, double ns)
+	{
+		BenchResult r;
+		r.name = name;
+		r.form = form;
+		r.ops = ops;
+		r.ns = ns;
+		m_results.push_back(r);
+	}
+
+	void print() const
+	{
+		printf("{\n  \"suite\": \"%s\",\n  \"results\": [\n", m_suite.c_str());
+		for (size_t i = 0; i < m_results.size(); i++)
+		{
+			const BenchResult& r = m_results[i];
+			double nsPerOp = r.ns / r.ops;
+			printf("    { \"name\": \"%s\", \"form\": \"%s\", \"ops\": %.0f, \"ns_per_op\": %.3f, \"ops_per_sec\": %.0f }%s\n",
+				r.name.c_str(), r.form.c_str(), r.ops, nsPerOp, 1e9 / nsPerOp,
+				i + 1 < m_results.size() ? "," : "");
+		}
+		printf("  ]\n}\n");
+	}
+};
@@ -0,0 +1,170 @@
+// LightBench.cpp : cost of lighting a surface point with ShadeBatch, eight at
+// a time in SSE, against ShadeBatchScalar, for growing numbers of mixed
+// directional, point and spot lights, both reflection models, and with the
+// directional and spot lights shadowed or not. Results go
+// to stdout as JSON, a "batched" and a "scalar" entry per case, ops counting
+// surface points; the largest difference between the two goes to stderr,
+// and over 1e-3 of the result fails the run.
+//
+// Headless, only needs Lighting.h:
+//	g++ -O2 -I../CG_skel_w_MFC LightBench.cpp -o LightBench
+//	./LightBench [batches] [passes]
+//
+
+#include "Lighting.h"
+#include "BenchUtil.h"
+#include <vector>
+#include <cstdlib>
+#include <cmath>
+
+using namespace std;
+
+volatile float g_sink;
+
+static float frand(float lo, float hi)
+{
+	return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+static void normalize3(float* v)
+{
+	float l = sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	for (int k = 0; k < 3; k++)
+		v[k] /= l;
+}
+
+// Lights around a 10 x 10 x 10 box, about half of them reaching each point.
+static vector<ShadingLight> makeLights(int count)
+{
+	vector<ShadingLight> lights(count);
+	for (int i = 0; i < count; i++)
+	{
+		ShadingLight& l = lights[i];
+		l.type = (LightType)(i % 3);
+		for (int k = 0; k < 3; k++)
+		{
+			l.position[k] = frand(-5, 5);
+			l.direction[k] = frand(-1, 1);
+			l.color[k] = frand(0.2f, 1) / count;
+		}
+		normalize3(l.direction);
+		l.range = frand(4, 12);
+		l.invRangeSquared = 1 / (l.range * l.range);
+		float outer = frand(0.3f, 0.8f), inner = outer * 0.7f;
+		l.cosOuter = cos(outer);
+		l.spotScale = 1 / (cos(inner) - l.cosOuter);
+		l.shadow = -1;
+	}
+	return lights;
+}
+
+// A shadow map of random depths over the box, seen along -z.
+static vector<float> makeShadowMap(ShadowMap& map, int size)
+{
+	vector<float> depth(size * size);
+	for (size_t i = 0; i < depth.size(); i++)
+		depth[i] = frand(0, 1);
+	map.depth = &depth[0];
+	map.size = size;
+	for (int r = 0; r < 4; r++)
+		for (int c = 0; c < 4; c++)
+			map.matrix[r][c] = 0;
+	// x and y from [-5, 5] to [0, size], z from [5, -5] to [0, 1]
+	map.matrix[0][0] = map.matrix[1][1] = size / 10.0f;
+	map.matrix[0][3] = map.matrix[1][3] = size / 2.0f;
+	map.matrix[2][2] = -0.1f;
+	map.matrix[2][3] = 0.5f;
+	map.matrix[3][3] = 1;
+	map.normalOffset = 10.0f / size;
+	map.bias = 1e-3f;
+	return depth;
+}
+
+static vector<SurfaceBatch> makeSurfaces(int count)
+{
+	vector<SurfaceBatch> batches(count);
+	for (int b = 0; b < count; b++)
+	{
+		SurfaceBatch& s = batches[b];
+		for (int j = 0; j < SHADE_BATCH; j++)
+		{
+			s.px[j] = frand(-5, 5);  s.py[j] = frand(-5, 5);  s.pz[j] = frand(-5, 5);
+			s.nx[j] = frand(-1, 1);  s.ny[j] = frand(-1, 1);  s.nz[j] = frand(-1, 1);
+			for (int k = 0; k < 3; k++)
+				s.albedo[k][j] = frand(0.2f, 1);
+			s.specular[j] = frand(0, 1);
+			s.shininess[j] = frand(4, 64);
+		}
+	}
+	return batches;
+}
+
+int main(int argc, char** argv)
+{
+	int count = argc > 1 ? atoi(argv[1]) : 2000;
+	int passes = argc > 2 ? atoi(argv[2]) : 5;
+
+	const int lightCounts[] = { 1, 8, 32, 64 };
+	const struct { const char* name; ReflectionModel model; } models[] = { { "phong", REFLECT_PHONG }, { "blinn", REFLECT_BLINN_PHONG } };
+
+	BenchReport report("lighting");
+	vector<SurfaceBatch> batched = makeSurfaces(count), scalar = batched;
+	ShadowMap shadow;
+	vector<float> shadowDepth = makeShadowMap(shadow, 256);
+	float worst = 0;
+	for (size_t m = 0; m < sizeof(models) / sizeof(models[0]); m++)
+	{
+		for (size_t c = 0; c < 2 * sizeof(lightCounts) / sizeof(lightCounts[0]); c++)
+		{
+			int lightCount = lightCounts[c / 2];
+			bool shadowed = (c & 1) != 0;
+			vector<ShadingLight> lights = makeLights(lightCount);
+			if (shadowed)
+				for (int i = 0; i < lightCount; i++)
+					if (lights[i].type != LIGHT_POINT)
+						lights[i].shadow = 0;
+			ShadingContext context;
+			context.lights = &lights[0];
+			context.list = NULL;
+			context.count = lightCount;
+			context.shadows = &shadow;
+			context.eye[0] = 0;  context.eye[1] = 2;  context.eye[2] = 20;
+			context.ambient[0] = context.ambient[1] = context.ambient[2] = 0.1f;
+			context.model = models[m].model;
+			char name[64];
+			sprintf(name, "%s_%d_lights%s", models[m].name, lightCount, shadowed ? "_shadowed" : "");
+
+			// alternating passes, after one untimed warm-up pass each
+			double batchedNs = 0, scalarNs = 0;
+			for (int p = -1; p < passes; p++)
+			{
+				BenchClock::time_point t = BenchClock::now();
+				for (int b = 0; b < count; b++)
+					ShadeBatch(context, batched[b]);
+				if (p >= 0)
+					batchedNs += elapsedNs(t);
+
+				t = BenchClock::now();
+				for (int b = 0; b < count; b++)
+					ShadeBatchScalar(context, scalar[b]);
+				if (p >= 0)
+					scalarNs += elapsedNs(t);
+			}
+			double points = (double)count * SHADE_BATCH * passes;
+			report.add(name, "batched", points, batchedNs);
+			report.add(name, "scalar", points, scalarNs);
+
+			for (int b = 0; b < count; b++)
+				for (int k = 0; k < 3; k++)
+					for (int j = 0; j < SHADE_BATCH; j++)
+					{
+						float a = batched[b].color[k][j], s = scalar[b].color[k][j];
+						worst = (std::max)(worst, fabs(a - s) / (std::max)(1.0f, fabs(s)));
+					}
+			g_sink = batched[0].color[0][0];
+		}
+	}
+	report.print();
+	fprintf(stderr, "largest difference: %g\n", worst);
+	return worst <= 1e-3f ? 0 : 1;
+}
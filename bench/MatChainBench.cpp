@@ -0,0 +1,99 @@
+// MatChainBench.cpp : per-frame matrix setup for many models, comparing the
+// plain mat4 operators with the matexpr.h expression templates.
+//
+// Headless, no GL context needed:
+//	g++ -O2 -I../CG_skel_w_MFC -I../glew/include MatChainBench.cpp -o MatChainBench
+//	./MatChainBench [models] [frames]
+//
+
+#include "vec.h"
+#include "mat.h"
+#include "matexpr.h"
+#include "BenchUtil.h"
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+
+using namespace std;
+
+volatile float g_sink;
+
+static float checksum(const mat4& m)
+{
+	const GLfloat* f = m;
+	float s = 0;
+	for (int i = 0; i < 16; i++)
+		s += f[i];
+	return s;
+}
+
+int main(int argc, char** argv)
+{
+	int models = argc > 1 ? atoi(argv[1]) : 5000;
+	int frames = argc > 2 ? atoi(argv[2]) : 200;
+
+	vector<mat4> world(models);
+	vector<vec4> center(models);
+	vector<mat4> mvp(models);
+	for (int i = 0; i < models; i++)
+	{
+		world[i] = Translate((float)(i % 100), (float)(i / 100), -10.0f) * RotateX((float)i) * Scale(0.5f, 0.5f, 0.5f);
+		center[i] = vec4((float)(i % 7), 1.0f, (float)(i % 3), 1.0f);
+	}
+	mat4 view = Translate(0, 0, -50) * RotateX(30);
+	mat4 projection(1.0f);
+	projection[3][2] = -1.0f;
+	projection[3][3] = 0.0f;
+
+	// 1. mvp = projection * view * world for every model
+	float sum = 0;
+	BenchClock::time_point t = BenchClock::now();
+	for (int f = 0; f < frames; f++)
+		for (int i = 0; i < models; i++)
+			mvp[i] = projection * view * world[i];
+	double naiveMat = elapsedNs(t);
+	sum += checksum(mvp[models - 1]);
+
+	t = BenchClock::now();
+	for (int f = 0; f < frames; f++)
+		for (int i = 0; i < models; i++)
+			(lazy(projection) * view * world[i]).eval(mvp[i]);
+	double lazyMat = elapsedNs(t);
+	sum += checksum(mvp[models - 1]);
+
+	// 2. one point per model (e.g. a bounding sphere center) through the chain
+	vec4 acc;
+	t = BenchClock::now();
+	for (int f = 0; f < frames; f++)
+		for (int i = 0; i < models; i++)
+			acc += projection * view * world[i] * center[i];
+	double naiveVec = elapsedNs(t);
+
+	t = BenchClock::now();
+	for (int f = 0; f < frames; f++)
+		for (int i = 0; i < models; i++)
+			acc += lazy(projection) * view * world[i] * center[i];
+	double lazyVec = elapsedNs(t);
+	sum += acc.x + acc.y + acc.z + acc.w;
+	g_sink = sum;
+
+	// both paths must agree before their timings mean anything
+	float maxError = 0;
+	for (int i = 0; i < models; i++)
+	{
+		mat4 a = projection * view * world[i];
+		mat4 b = lazy(projection) * view * world[i];
+		const GLfloat* fa = a;
+		const GLfloat* fb = b;
+		for (int k = 0; k < 16; k++)
+			maxError = max(maxError, fabs(fa[k] - fb[k]));
+	}
+
+	double n = (double)models * frames;
+	printf("models=%d frames=%d max_error=%g\n", models, frames, maxError);
+	printf("mat4 chain   naive %8.2f ns/model   lazy %8.2f ns/model   speedup %.2fx\n",
+		naiveMat / n, lazyMat / n, naiveMat / lazyMat);
+	printf("point chain  naive %8.2f ns/model   lazy %8.2f ns/model   speedup %.2fx\n",
+		naiveVec / n, lazyVec / n, naiveVec / lazyVec);
+	return 0;
+}
@@ -0,0 +1,163 @@
+// MathBench.cpp : throughput of the hot vec.h / mat.h operations.
+//
+// Every operation is measured in two forms:
+//	scalar  - one call at a time, each call depending on the previous one
+//	batched - independent calls over arrays, the way a vertex loop runs
+// Results go to stdout as JSON (ns_per_op and ops_per_sec per entry).
+//
+// Headless, no GL context needed:
+//	g++ -O2 -I../CG_skel_w_MFC -I../glew/include MathBench.cpp -o MathBench
+//	./MathBench [scale]
+//
+
+#include "vec.h"
+#include "mat.h"
+#include "BenchUtil.h"
+#include <vector>
+#include <cstdlib>
+
+using namespace std;
+
+volatile float g_sink;
+
+static const int kBatch = 1024;
+
+static float frand()
+{
+	return (float)rand() / RAND_MAX * 2.0f - 1.0f;
+}
+
+static float sum(const mat4& m)
+{
+	const GLfloat* f = m;
+	float s = 0;
+	for (int i = 0; i < 16; i++)
+		s += f[i];
+	return s;
+}
+
+// Times reps passes of body(i) over i in [0, kBatch).
+template <class F>
+static void batched(BenchReport& report, const char* name, int reps, F body)
+{
+	BenchClock::time_point t = BenchClock::now();
+	for (int r = 0; r < reps; r++)
+		for (int i = 0; i < kBatch; i++)
+			body(i);
+	report.add(name, "batched", (double)reps * kBatch, elapsedNs(t));
+}
+
+// Times n calls of step(), which carries its own loop dependency.
+template <class F>
+static void scalar(BenchReport& report, const char* name, int n, F step)
+{
+	BenchClock::time_point t = BenchClock::now();
+	for (int i = 0; i < n; i++)
+		step();
+	report.add(name, "scalar", (double)n, elapsedNs(t));
+}
+
+int main(int argc, char** argv)
+{
+	int scale = argc > 1 ? atoi(argv[1]) : 1;
+	int reps = 2000 * scale;
+	int n = kBatch * reps;
+
+	vector<vec3> a3(kBatch), b3(kBatch), o3(kBatch);
+	vector<vec4> a4(kBatch), b4(kBatch), o4(kBatch);
+	vector<mat4> am(kBatch), bm(kBatch), om(kBatch);
+	vector<float> f(kBatch), of(kBatch);
+	for (int i = 0; i < kBatch; i++)
+	{
+		a3[i] = vec3(frand(), frand(), frand());
+		b3[i] = vec3(frand(), frand(), frand());
+		a4[i] = vec4(a3[i], 1.0f);
+		b4[i] = vec4(b3[i], 1.0f);
+		am[i] = RotateX(frand() * 180) * Translate(a3[i]);
+		bm[i] = Translate(b3[i]) * RotateX(frand() * 180);
+		f[i] = frand() * 100;
+	}
+
+	BenchReport report("vec_mat");
+	float acc = 0;
+
+	// dot
+	{
+		vec3 a = a3[0];
+		float s = 0;
+		scalar(report, "dot_vec3", n, [&]() { s = dot(vec3(s, a.y, a.z), a) * 0.5f; });
+		acc += s;
+		batched(report, "dot_vec3", reps, [&](int i) { of[i] = dot(a3[i], b3[i]); });
+		vec4 a4s = a4[0];
+		scalar(report, "dot_vec4", n, [&]() { s = dot(vec4(s, a4s.y, a4s.z, a4s.w), a4s) * 0.5f; });
+		acc += s;
+		batched(report, "dot_vec4", reps, [&](int i) { of[i] = dot(a4[i], b4[i]); });
+		acc += of[kBatch - 1];
+	}
+
+	// cross
+	{
+		vec3 v = a3[0], a = normalize(a3[1]), b = b3[2];
+		scalar(report, "cross_vec3", n, [&]() { v = cross(v, a) + b; });
+		acc += v.x;
+		batched(report, "cross_vec3", reps, [&](int i) { o3[i] = cross(a3[i], b3[i]); });
+		acc += o3[kBatch - 1].x;
+	}
+
+	// normalize
+	{
+		vec3 v = a3[0], a = a3[1];
+		scalar(report, "normalize_vec3", n, [&]() { v = normalize(v + a); });
+		acc += v.x;
+		batched(report, "normalize_vec3", reps, [&](int i) { o3[i] = normalize(a3[i]); });
+		vec4 w = a4[0], b = a4[1];
+		scalar(report, "normalize_vec4", n, [&]() { w = normalize(w + b); });
+		acc += w.x + o3[kBatch - 1].x;
+		batched(report, "normalize_vec4", reps, [&](int i) { o4[i] = normalize(a4[i]); });
+		acc += o4[kBatch - 1].x;
+	}
+
+	// mat4 * vec4
+	{
+		mat4 m = RotateX(33);
+		vec4 v = a4[0];
+		scalar(report, "mat4_mul_vec4", n, [&]() { v = m * v; });
+		acc += v.x;
+		batched(report, "mat4_mul_vec4", reps, [&](int i) { o4[i] = am[i] * a4[i]; });
+		acc += o4[kBatch - 1].x;
+	}
+
+	// mat4 * mat4, fewer iterations since each op is ~16x the work
+	{
+		int mreps = reps / 8;
+		mat4 m = am[0], r = RotateX(1);
+		scalar(report, "mat4_mul_mat4", kBatch * mreps, [&]() { m = m * r; });
+		acc += sum(m);
+		batched(report, "mat4_mul_mat4", mreps, [&](int i) { om[i] = am[i] * bm[i]; });
+		acc += sum(om[kBatch - 1]);
+
+		scalar(report, "transpose_mat4", kBatch * mreps, [&]() { m = transpose(m); });
+		acc += sum(m);
+		batched(report, "transpose_mat4", mreps, [&](int i) { om[i] = transpose(am[i]); });
+		acc += sum(om[kBatch - 1]);
+	}
+
+	// generators
+	{
+		int greps = reps / 4;
+		float x = 1;
+		scalar(report, "Translate", kBatch * greps, [&]() { x = sum(Translate(x, 1, 2)) * 0.25f; });
+		batched(report, "Translate", greps, [&](int i) { om[i] = Translate(f[i], 1, 2); });
+		acc += x + sum(om[kBatch - 1]);
+		scalar(report, "Scale", kBatch * greps, [&]() { x = sum(Scale(x, 1, 2)) * 0.25f; });
+		batched(report, "Scale", greps, [&](int i) { om[i] = Scale(f[i], 1, 2); });
+		acc += x + sum(om[kBatch - 1]);
+		scalar(report, "RotateX", kBatch * greps, [&]() { x = sum(RotateX(x)) * 10; });
+		batched(report, "RotateX", greps, [&](int i) { om[i] = RotateX(f[i]); });
+		acc += x + sum(om[kBatch - 1]);
+	}
+
+	g_sink = acc;
+	report.print();
+	return 0;
+}
@@ -0,0 +1,228 @@
+// RasterBench.cpp : fill rate of the specialized fill loops (SelectFill) against
+// the generic one that tests the pipeline state per pixel (and lights pixels
+// one at a time), for a set of pipeline states and triangle sizes. Both must leave identical buffers.
+// Results go to stdout as JSON, one "specialized" and one "generic" entry
+// per case, ops counting triangles.
+//
+// Headless, only needs Rasterizer.h:
+//	g++ -O2 -I../CG_skel_w_MFC RasterBench.cpp -o RasterBench
+//	./RasterBench [triangles] [passes]
+//
+
+#include "Rasterizer.h"
+#include "BenchUtil.h"
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+
+using namespace std;
+
+volatile float g_sink;
+
+static const int kSize = 512;
+
+// lit cases: eight point lights over the attributes' [0,1] positions
+static ShadingLight g_lights[8];
+static ShadingContext g_shading;
+
+static void makeLights()
+{
+	for (int i = 0; i < 8; i++)
+	{
+		ShadingLight& l = g_lights[i];
+		l.type = LIGHT_POINT;
+		l.position[0] = (i & 1) ? 1.5f : -0.5f;
+		l.position[1] = (i & 2) ? 1.5f : -0.5f;
+		l.position[2] = (i & 4) ? 1.5f : -0.5f;
+		l.direction[0] = l.direction[1] = 0;  l.direction[2] = -1;
+		l.color[0] = l.color[1] = l.color[2] = 0.2f;
+		l.range = 2;
+		l.invRangeSquared = 0.25f;
+		l.cosOuter = 0;
+		l.spotScale = 1;
+		l.shadow = -1;
+	}
+	g_shading.lights = g_lights;
+	g_shading.list = NULL;
+	g_shading.count = 8;
+	g_shading.shadows = NULL;
+	g_shading.eye[0] = 0.5f;  g_shading.eye[1] = 0.5f;  g_shading.eye[2] = 3;
+	g_shading.ambient[0] = g_shading.ambient[1] = g_shading.ambient[2] = 0.1f;
+	g_shading.model = REFLECT_BLINN_PHONG;
+}
+
+static float frand(float lo, float hi)
+{
+	return lo + (hi - lo) * rand() / RAND_MAX;
+}
+
+struct Triangle
+{
+	float v[3][4];
+	float attributes[3][MAX_ATTRIBUTES];
+};
+
+// Frame to draw into, both depth formats sharing one plane as in FrameBuffer.
+struct Frame
+{
+	vector<float> color;
+	vector<float> depth;
+	vector<GBufferTexel> gbuffer;
+
+	Frame() : color(3 * kSize * kSize), depth(kSize * kSize), gbuffer(kSize * kSize) {}
+
+	void clear(DepthFormat format)
+	{
+		fill(color.begin(), color.end(), 0.0f);
+		memset(&gbuffer[0], 0, gbuffer.size() * sizeof(GBufferTexel));
+		if (format == DEPTH_UNORM16)
+		{
+			unsigned short* d = (unsigned short*)&depth[0];
+			fill(d, d + kSize * kSize, (unsigned short)65535);
+		}
+		else
+			fill(depth.begin(), depth.end(), 1.0f);
+	}
+
+	FillTarget target()
+	{
+		FillTarget t;
+		t.color = &color[0];
+		t.depth = &depth[0];
+		t.gbuffer = &gbuffer[0];
+		t.stride = kSize;
+		t.x0 = t.y0 = 0;
+		t.x1 = t.y1 = kSize;
+		t.shading = &g_shading;
+		return t;
+	}
+};
+
+static vector<Triangle> makeTriangles(int count, float size)
+{
+	vector<Triangle> triangles(count);
+	for (int i = 0; i < count; i++)
+	{
+		float cx = frand(0, (float)kSize), cy = frand(0, (float)kSize);
+		for (int k = 0; k < 3; k++)
+		{
+			float* v = triangles[i].v[k];
+			v[0] = cx + frand(-size, size);
+			v[1] = cy + frand(-size, size);
+			v[2] = frand(0.1f, 0.9f);
+			v[3] = frand(0.25f, 1.0f);	// 1/w, so attributes are perspective corrected
+			for (int a = 0; a < MAX_ATTRIBUTES; a++)
+				triangles[i].attributes[k][a] = frand(0, 1);
+		}
+	}
+	return triangles;
+}
+
+static TriangleSetup setupOf(const Triangle& t, int attributes)
+{
+	FillInput input;
+	for (int k = 0; k < 3; k++)
+	{
+		input.v[k] = t.v[k];
+		input.attributes[k] = t.attributes[k];
+	}
+	input.color[0] = 0.8f;
+	input.color[1] = 0.5f;
+	input.color[2] = 0.2f;
+	input.alpha = 0.5f;
+	input.specular = 0.5f;
+	input.shininess = 16;
+	input.material = 1;
+	TriangleSetup setup;
+	setup.init(input, attributes);
+	return setup;
+}
+
+struct Case
+{
+	const char* name;
+	bool depthTest;
+	DepthFormat depthFormat;
+	ShadeModel shading;
+	int attributes;
+	BlendMode blend;
+};
+
+int main(int argc, char** argv)
+{
+	int count = argc > 1 ? atoi(argv[1]) : 20000;
+	int passes = argc > 2 ? atoi(argv[2]) : 5;
+
+	const Case cases[] = {
+		{ "flat_depth32", true, DEPTH_FLOAT32, SHADE_FLAT, 0, BLEND_NONE },
+		{ "flat_depth16", true, DEPTH_UNORM16, SHADE_FLAT, 0, BLEND_NONE },
+		{ "flat_nodepth", false, DEPTH_FLOAT32, SHADE_FLAT, 0, BLEND_NONE },
+		{ "rgb_depth32", true, DEPTH_FLOAT32, SHADE_INTERPOLATED, 3, BLEND_NONE },
+		{ "attr6_depth32_alpha", true, DEPTH_FLOAT32, SHADE_INTERPOLATED, MAX_ATTRIBUTES, BLEND_ALPHA },
+		{ "rgb_nodepth_add", false, DEPTH_FLOAT32, SHADE_INTERPOLATED, 3, BLEND_ADD },
+		{ "lit8_depth32", true, DEPTH_FLOAT32, SHADE_LIT, MAX_ATTRIBUTES, BLEND_NONE },
+		{ "gbuffer_depth32", true, DEPTH_FLOAT32, SHADE_GBUFFER, 3, BLEND_NONE },
+		{ "depthonly_depth32", true, DEPTH_FLOAT32, SHADE_DEPTH, 0, BLEND_NONE },
+		{ "depthonly_depth16", true, DEPTH_UNORM16, SHADE_DEPTH, 0, BLEND_NONE },
+	};
+	const struct { const char* name; float size; } sizes[] = { { "small", 4 }, { "large", 40 } };
+
+	makeLights();
+	BenchReport report("raster");
+	Frame specialized, generic;
+	int mismatches = 0;
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+	{
+		vector<Triangle> triangles = makeTriangles(count, sizes[s].size);
+		for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++)
+		{
+			const Case& k = cases[c];
+			FillState state;
+			state.depthTest = k.depthTest;
+			state.depthFormat = k.depthFormat;
+			state.shading = k.shading;
+			state.attributes = k.attributes;
+			state.blend = k.blend;
+			string name = string(k.name) + "_" + sizes[s].name;
+
+			// passes alternate between the two, after one untimed warm-up pass
+			// each; every pass is one draw, the specialized loop is selected
+			// once per draw as Renderer does. Triangle setup is timed too.
+			int attributes = k.attributes > 3 ? MAX_ATTRIBUTES : k.attributes > 0 ? 3 : 0;
+			double specializedNs = 0, genericNs = 0;
+			for (int p = -1; p < passes; p++)
+			{
+				specialized.clear(k.depthFormat);
+				FillTarget target = specialized.target();
+				BenchClock::time_point t = BenchClock::now();
+				FillFunction fill = SelectFill(state);
+				for (int i = 0; i < count; i++)
+					fill(target, setupOf(triangles[i], attributes));
+				if (p >= 0)
+					specializedNs += elapsedNs(t);
+
+				generic.clear(k.depthFormat);
+				target = generic.target();
+				t = BenchClock::now();
+				for (int i = 0; i < count; i++)
+					FillTriangleGeneric(state, target, setupOf(triangles[i], attributes));
+				if (p >= 0)
+					genericNs += elapsedNs(t);
+			}
+			report.add(name.c_str(), "specialized", (double)count * passes, specializedNs);
+			report.add(name.c_str(), "generic", (double)count * passes, genericNs);
+
+			// timings only count if both paths drew the same thing
+			if (memcmp(&specialized.color[0], &generic.color[0], specialized.color.size() * sizeof(float)) != 0 ||
+				memcmp(&specialized.depth[0], &generic.depth[0], specialized.depth.size() * sizeof(float)) != 0 ||
+				memcmp(&specialized.gbuffer[0], &generic.gbuffer[0], specialized.gbuffer.size() * sizeof(GBufferTexel)) != 0)
+			{
+				fprintf(stderr, "mismatch: %s\n", name.c_str());
+				mismatches++;
+			}
+			g_sink = specialized.color[3 * (kSize * kSize / 2)];
+		}
+	}
+	report.print();
+	return mismatches == 0 ? 0 : 1;
+}